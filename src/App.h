@@ -1,5 +1,8 @@
 #pragma once
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include "Debase.h"
@@ -19,6 +22,7 @@
 #include "state/Theme.h"
 #include "state/State.h"
 #include "git/Conflict.h"
+#include "git/FirstParentIndex.h"
 #include "lib/toastbox/String.h"
 #include "xterm-256color.h"
 #include "Terminal.h"
@@ -29,6 +33,7 @@
 #include "Syscall.h"
 #include "Rev.h"
 #include "ConflictText.h"
+#include "DropSpeculator.h"
 
 extern "C" {
     extern char** environ;
@@ -69,12 +74,14 @@ public:
     
     void draw() override {
         const UI::Color selectionColor = (_drag.copy ? colors().selectionCopy : colors().selection);
+        // Dropping at a position that's known to conflict is shown in the error color
+        const UI::Color dragColor = (_drag.conflict ? colors().error : selectionColor);
         
         if (_drag.titlePanel) {
-            _drag.titlePanel->borderColor(selectionColor);
+            _drag.titlePanel->borderColor(dragColor);
             
             for (UI::PanelPtr panel : _drag.shadowPanels) {
-                panel->borderColor(selectionColor);
+                panel->borderColor(dragColor);
             }
         }
         
@@ -97,7 +104,7 @@ public:
         if (_drag.titlePanel) {
             // Draw insertion marker
             if (_drag.insertionMarker) {
-                Attr color = attr(selectionColor);
+                Attr color = attr(dragColor);
                 drawLineHoriz(_drag.insertionMarker->origin, _drag.insertionMarker->size.x);
             }
         }
@@ -112,7 +119,11 @@ public:
         switch (ev.type) {
         case UI::Event::Type::Mouse: {
             const _HitTestResult hitTest = _hitTest(ev.mouse.origin);
-            if (ev.mouseDown(UI::Event::MouseButtons::Left)) {
+            if (const int dir = ev.mouseScroll()) {
+                UI::RevColumnPtr col = _columnHitTest(ev.mouse.origin);
+                if (col) _columnScroll(col, dir*_ScrollWheelCommits);
+                
+            } else if (ev.mouseDown(UI::Event::MouseButtons::Left)) {
                 const bool shift = (ev.mouse.bstate & _SelectionShiftKeys);
                 if (hitTest && !shift) {
                     if (hitTest.panel) {
@@ -140,6 +151,22 @@ public:
             break;
         }
         
+        case UI::Event::Type::KeyUp:
+        case UI::Event::Type::KeyDown:
+        case UI::Event::Type::KeyPageUp:
+        case UI::Event::Type::KeyPageDown: {
+            const bool up = (ev.type==UI::Event::Type::KeyUp || ev.type==UI::Event::Type::KeyPageUp);
+            const bool page = (ev.type==UI::Event::Type::KeyPageUp || ev.type==UI::Event::Type::KeyPageDown);
+            // Scroll the selection's column, or every column if there's no selection
+            UI::RevColumnPtr selectionColumn = (!_selection.commits.empty() ? _columnForRev(_selection.rev) : nullptr);
+            for (UI::RevColumnPtr col : _columns) {
+                if (selectionColumn && col!=selectionColumn) continue;
+                const ssize_t count = (page ? std::max((ssize_t)1, (ssize_t)col->panels().size()-1) : 1);
+                _columnScroll(col, (up ? -count : count));
+            }
+            break;
+        }
+        
         case UI::Event::Type::KeyDelete:
         case UI::Event::Type::KeyFnDelete: {
             if (!_selectionCanDelete()) {
@@ -166,7 +193,7 @@ public:
             
             assert(_selection.commits.size() == 1);
             const Rev& rev = _selection.rev;
-            const Git::Commit& commit = *_selection.commits.begin();
+            const Git::Commit commit = _repo.commitLookup(*_selection.commits.begin());
             _revCreate(_RevCreateType::Branch, rev, commit);
             break;
         }
@@ -231,37 +258,62 @@ public:
     }
     
     void run() {
-        _theme = State::ThemeRead();
+        // Read our global state once, releasing its lock before doing anything slow
+        State::Theme theme = State::Theme::None;
+        {
+            State::State state(StateDir());
+            theme = state.theme();
+            _moveOfferNeeded = (state.lastMoveOfferVersion() < DebaseVersion);
+        }
+        
+        // Resolve the theme concurrently with loading the repository below, since it
+        // can involve waiting up to 500ms for the terminal to report its background color
+        std::future<State::Theme> themeResolve = std::async(std::launch::async, State::ThemeResolve, theme);
         
         // Handle being run outside of a git repo
         // We show a dialog in this case, and still offer to move debase to ~/bin, so that
         // the first-run experience is decent even when run outside of a git repo, which
         // is likely on the first invocation
         if (!_repo) {
+            _theme = themeResolve.get();
             _runNoRepo();
             return;
         }
         
         _head = _repo.headResolved();
-        
-        // Create _repoState
-        std::set<Git::Ref> refs;
-        for (const Rev& rev : _revs) {
-            if (rev.ref) refs.insert(rev.ref);
-        }
-        _repoState = State::RepoState(StateDir(), _repo, refs);
+        _headTree = _head.commit.tree();
+        if (_revs.empty()) _revs = _RevsDefault(_repo, _head);
         
         // If the repo has outstanding changes, prevent the currently checked-out
         // branch from being modified, since we can't clobber the uncommitted
         // changes. We do this by marking all refs that match HEAD's ref as
         // immutable.
-        if (_repo.dirty() && _head.ref) {
+        // Checking for changes requires scanning the working tree, so do it on a
+        // separate thread, and keep the branch immutable until the check completes.
+        // _dirtyCheckUpdate() applies the result.
+        if (_head.ref) {
             for (Rev& rev : _revs) {
                 if (rev.ref && rev.ref==_head.ref) {
-                    rev.mutability = Rev::Mutability::DisallowedUncommittedChanges;
+                    rev.mutability = Rev::Mutability::DisallowedUncommittedChangesCheck;
                 }
             }
+            
+            _dirtyCheck = std::async(std::launch::async, [repo = _repo.reopen()] {
+                Trace::ThreadName("dirty check");
+                return repo.dirty();
+            });
+        }
+        
+        // Create _repoState
+        std::set<Git::Ref> refs;
+        for (const Rev& rev : _revs) {
+            if (rev.ref) refs.insert(rev.ref);
         }
+        _repoState = State::RepoState(StateDir(), _repo, refs);
+        _resolutionCache = State::ResolutionCache(StateDir());
+        State::MergeCacheRead(_repoState, *_mergeCache);
+        
+        _theme = themeResolve.get();
         
         // Reattach head upon return
         // We do this via Defer() so that it executes even if there's an exception
@@ -274,7 +326,9 @@ public:
                 std::cout << "Restoring HEAD to " << _head.ref.name() << std::endl;
                 std::string err;
                 try {
-                    _repo.headAttach(_head);
+                    // The index and working tree still match HEAD's tree from when we
+                    // started, so only the paths that changed since then need updating
+                    _repo.headAttach(_repo.revReload(_head), _headTree);
                 } catch (const Git::ConflictError& e) {
                     err = "Error: checkout failed because these untracked files would be overwritten:\n";
                     for (const _Path& path : e.paths) {
@@ -311,6 +365,32 @@ public:
         }
         
         _repoState.write();
+        State::MergeCacheWrite(_repoState, *_mergeCache);
+    }
+    
+    using UI::Screen::eventNext;
+    UI::Event eventNext(Deadline deadline=Forever) override {
+        using namespace std::chrono;
+        const bool timed = (deadline!=Forever && deadline!=Once);
+        for (;;) {
+            if (!_columnsLoading() && !_dirtyCheck.valid() && !_dragSpeculating()) return UI::Screen::eventNext(deadline);
+            
+            // While columns are loading, wake up periodically to pick up their
+            // loaded commits and animate their placeholders. Likewise while we're
+            // waiting on the dirty check, or on the speculation of a drop.
+            const Deadline tick = steady_clock::now()+_LoadPollInterval;
+            const UI::Event ev = UI::Screen::eventNext(timed ? std::min(deadline, tick) : tick);
+            if (ev) return ev;
+            
+            for (UI::RevColumnPtr col : _columns) {
+                col->loadUpdate();
+            }
+            _dirtyCheckUpdate();
+            _dragConflictUpdate();
+            layoutNeeded(true);
+            
+            if (timed && steady_clock::now()>=deadline) return {};
+        }
     }
     
     void track(Deadline deadline=Forever) override {
@@ -360,7 +440,22 @@ private:
     
     struct _Selection {
         Rev rev;
-        std::set<Git::Commit> commits;
+        Git::IdSet commits;
+    };
+    
+    // _GitOpThread: state shared between the UI thread and the thread that executes
+    // a git operation; protected by `lock`
+    struct _GitOpThread {
+        std::mutex lock;
+        std::condition_variable signal;
+        std::function<void()> uiCall; // Work that the git op thread is waiting on the UI thread to perform
+        std::exception_ptr uiCallErr;
+        size_t progressIdx = 0;
+        size_t progressCount = 0;
+        bool cancel = false;  // User canceled the operation
+        bool exit = false;    // User requested to exit once the operation is done
+        bool abandon = false; // UI thread is no longer servicing uiCall
+        bool done = false;
     };
     
     enum class _SelectState {
@@ -431,18 +526,28 @@ private:
     static constexpr int _ColumnInsetX = 3;
     static constexpr int _ColumnWidth = 32;
     static constexpr int _ColumnSpacing = 6;
+    static constexpr int _ScrollWheelCommits = 3;
+    static constexpr auto _LoadWaitMax = std::chrono::milliseconds(50);
+    static constexpr auto _LoadPollInterval = std::chrono::milliseconds(100);
+    static constexpr auto _GitOpProgressDelay = std::chrono::milliseconds(250);
+    static constexpr auto _GitOpPollInterval = std::chrono::milliseconds(50);
     
     static constexpr int _SnapshotMenuWidth = 26;
     static constexpr auto _DoubleClickThresh = std::chrono::milliseconds(300);
     static constexpr mmask_t _SelectionShiftKeys = BUTTON_CTRL | BUTTON_SHIFT;
     
-    static Git::Commit _FindLatestCommit(Git::Commit head, const std::set<Git::Commit>& commits) {
-        while (head) {
-            if (commits.find(head) != commits.end()) return head;
-            head = head.parent();
+    static Git::Commit _FindLatestCommit(Git::Commit head, const Git::IdSet& commits) {
+        const Git::FirstParentIndex index(head);
+        std::optional<size_t> latestDepth;
+        for (const Git::Id& commit : commits) {
+            const std::optional<size_t> depth = index.depth(commit);
+            if (depth && (!latestDepth || *depth<*latestDepth)) {
+                latestDepth = depth;
+            }
         }
         // Programmer error if it doesn't exist
-        abort();
+        if (!latestDepth) abort();
+        return index.at(*latestDepth);
     }
     
     static UI::ColorPalette _ColorsCreate(State::Theme theme) {
@@ -533,7 +638,7 @@ private:
     }
     
     _SelectState _selectStateGet(UI::RevColumnPtr col, UI::CommitPanelPtr panel) {
-        bool similar = _selection.commits.find(panel->commit()) != _selection.commits.end();
+        bool similar = _selection.commits.contains(panel->commit());
         if (!similar) return _SelectState::False;
         return (col->rev()==_selection.rev ? _SelectState::True : _SelectState::Similar);
     }
@@ -564,6 +669,30 @@ private:
         return {};
     }
     
+    bool _columnsLoading() const {
+        for (UI::RevColumnPtr col : _columns) {
+            if (col->loading()) return true;
+        }
+        return false;
+    }
+    
+    UI::RevColumnPtr _columnHitTest(const UI::Point& p) {
+        for (UI::RevColumnPtr col : _columns) {
+            if (HitTest(col->frame(), p)) return col;
+        }
+        return nullptr;
+    }
+    
+    // _columnScroll(): scrolls `col` by `delta` commits, and reloads it if its
+    // scroll position changed
+    void _columnScroll(UI::RevColumnPtr col, ssize_t delta) {
+        if (!col->scrollBy(delta)) return;
+        col->reload({_ColumnWidth, size().y});
+        col->loadWait(std::chrono::steady_clock::now()+_LoadWaitMax);
+        layoutNeeded(true);
+        eraseNeeded(true);
+    }
+    
     std::optional<_InsertionPosition> _findInsertionPosition(const UI::Point& p) {
         UI::RevColumnPtr icol;
         UI::CommitPanelIter iiter;
@@ -608,6 +737,54 @@ private:
         return _InsertionPosition{icol, iiter};
     }
     
+    // _dragOp(): returns the operation that dropping the selection at `ipos` performs
+    _GitOp _dragOp(const _InsertionPosition& ipos) const {
+        // Inserting below the last visible panel inserts above the commit that follows
+        // it, which is only nullptr (ie, before the root commit) if the column's entire
+        // history is visible
+        Git::Commit dstCommit = ((ipos.iter != ipos.col->panels().end()) ? (*ipos.iter)->commit() : ipos.col->commitBelow());
+        return _GitOp{
+            .type = (_drag.copy ? _GitOp::Type::Copy : _GitOp::Type::Move),
+            .src = {
+                .rev = _selection.rev,
+                .commits = _selection.commits,
+            },
+            .dst = {
+                .rev = ipos.col->rev(),
+                .position = dstCommit,
+            }
+        };
+    }
+    
+    // _dragSpeculate(): starts computing the result of the drag's operation in the
+    // background, unless it's already known
+    void _dragSpeculate() {
+        if (!_drag.op) return;
+        if (!_dropSpeculator) _dropSpeculator = std::make_unique<DropSpeculator>(_repo.path(), _mergeCache);
+        if (_dropSpeculator->state(*_drag.op) != DropSpeculator::State::Unknown) return;
+        _dropSpeculator->speculate(*_drag.op);
+    }
+    
+    bool _dragSpeculating() {
+        return _drag.op && _dropSpeculator &&
+            _dropSpeculator->state(*_drag.op)==DropSpeculator::State::Pending;
+    }
+    
+    // _dragConflictUpdate(): updates whether the drag's operation is known to conflict
+    void _dragConflictUpdate() {
+        const bool conflict = _drag.op && _dropSpeculator &&
+            _dropSpeculator->state(*_drag.op)==DropSpeculator::State::Conflict;
+        if (conflict == _drag.conflict) return;
+        _drag.conflict = conflict;
+        if (_drag.titlePanel) _drag.titlePanel->header()->text(_dragTitle());
+        eraseNeeded(true);
+    }
+    
+    std::string _dragTitle() const {
+        const std::string title = (_drag.copy ? "Copy" : "Move");
+        return (_drag.conflict ? title + " (will conflict)" : title);
+    }
+    
     UI::RevColumnPtr _columnForRev(const Rev& rev) {
         for (UI::RevColumnPtr col : _columns) {
             if (col->rev() == rev) return col;
@@ -617,14 +794,6 @@ private:
 //        abort();
     }
     
-    UI::CommitPanelPtr _panelForCommit(UI::RevColumnPtr col, Git::Commit commit) {
-        for (UI::CommitPanelPtr panel : col->panels()) {
-            if (panel->commit() == commit) return panel;
-        }
-        // Programmer error if it doesn't exist
-        abort();
-    }
-    
     UI::ButtonPtr _makeSnapshotMenuButton(const Git::Ref& ref, const State::Snapshot& snap,
         bool sessionStart, UI::SnapshotButton*& chosen) {
         
@@ -656,8 +825,8 @@ private:
         if (_selection.commits.empty()) return false;
         
         bool selectionContainsMerge = false;
-        for (Git::Commit commit : _selection.commits) {
-            if (commit.isMerge()) {
+        for (const Git::Id& commit : _selection.commits) {
+            if (_repo.commitLookup(commit).isMerge()) {
                 selectionContainsMerge = true;
                 break;
             }
@@ -667,7 +836,7 @@ private:
     
     bool _selectionCanEdit() {
         if (_selection.commits.empty()) return false;
-        return _selection.rev.isMutable() && _selection.commits.size() == 1;
+        return _selection.rev.isMutable();
     }
     
     bool _selectionCanDelete() {
@@ -773,7 +942,80 @@ private:
         }
     }
     
+    // _RevsDefault(): returns HEAD, followed by the most recently checked-out revs
+    static std::vector<Rev> _RevsDefault(const Git::Repo& repo, const Git::Rev& head) {
+        constexpr size_t RevCountDefault = 5;
+        std::vector<Rev> revs;
+        std::set<Rev> unique;
+        
+        // Add HEAD to `revs`
+        {
+            Rev rev;
+            (Git::Rev&)rev = head;
+            revs.emplace_back(rev);
+            unique.insert(rev);
+        }
+        
+        // Fill out `revs` with recent revs that were checked out, until we hit `RevCountDefault`
+        Git::Reflog reflog = repo.reflogForRef(repo.head());
+        for (size_t i=0; revs.size()<RevCountDefault; i++) {
+            const git_reflog_entry*const entry = reflog[i];
+            if (!entry) break; // End of reflog
+            
+            try {
+                Rev rev;
+                (Git::Rev&)rev = repo.reflogRevForCheckoutEntry(entry);
+                // Ignore non-ref reflog entries
+                if (!rev.ref) continue;
+                const auto [_, inserted] = unique.insert(rev);
+                if (inserted) revs.emplace_back(rev);
+            
+            // Ignore errors -- refs mentioned in the reflog may have been deleted,
+            // which will throw when we try to lookup
+            } catch (const std::exception& e) {}
+        }
+        return revs;
+    }
+    
+    // _dirtyCheckUpdate(): applies the result of the dirty check once it completes, by
+    // making the revs that match HEAD's ref mutable, unless the repo has uncommitted changes
+    void _dirtyCheckUpdate() {
+        using namespace std::chrono;
+        if (!_dirtyCheck.valid()) return;
+        if (_dirtyCheck.wait_for(seconds(0)) != std::future_status::ready) return;
+        
+        bool dirty = true;
+        try {
+            dirty = _dirtyCheck.get();
+        } catch (...) {
+            // Leave the branch immutable if we couldn't determine whether it has changes
+        }
+        
+        const Rev::Mutability mutability = (dirty ? Rev::Mutability::DisallowedUncommittedChanges : Rev::Mutability::Allowed);
+        for (Rev& rev : _revs) {
+            if (rev.mutability == Rev::Mutability::DisallowedUncommittedChangesCheck) {
+                rev.mutability = mutability;
+            }
+        }
+        
+        if (_selection.rev.mutability == Rev::Mutability::DisallowedUncommittedChangesCheck) {
+            _selection.rev.mutability = mutability;
+        }
+        
+        // Update the columns in place rather than reloading, since we can be called while
+        // tracking the mouse (eg during a drag), whose views a reload would remove
+        for (UI::RevColumnPtr col : _columns) {
+            Rev rev = col->rev();
+            if (rev.mutability != Rev::Mutability::DisallowedUncommittedChangesCheck) continue;
+            rev.mutability = mutability;
+            col->rev(rev); // Triggers a layout, which updates the column's read-only status
+        }
+        
+        eraseNeeded(true);
+    }
+    
     void _reload() {
+        const Trace::Span trace("App::_reload");
         // We allow ourself to be called outside of a git repo, so we need
         // to check _repo for null
         if (_repo) {
@@ -850,6 +1092,13 @@ private:
         // Erase columns that aren't visible
         _columns.erase(_columns.begin()+colCount, _columns.end());
         
+        // Give the columns a moment to finish loading, so that we only show
+        // placeholders when loading is actually slow
+        const auto loadDeadline = std::chrono::steady_clock::now()+_LoadWaitMax;
+        for (UI::RevColumnPtr col : _columns) {
+            col->loadWait(loadDeadline);
+        }
+        
         // Update subviews
         for (UI::PanelPtr panel : _panels) {
             sv.push_back(panel);
@@ -889,8 +1138,8 @@ private:
         UI::RevColumnPtr selectionColumn = _columnForRev(_selection.rev);
         if (!selectionColumn) abort();
         
+        // The title commit may be scrolled out of view, so we can't rely on it having a panel
         Git::Commit titleCommit = _FindLatestCommit(_selection.rev.commit, _selection.commits);
-        UI::CommitPanelPtr titlePanel = _panelForCommit(selectionColumn, titleCommit);
         
         UI::Event ev = mouseDownEvent;
         std::optional<_InsertionPosition> ipos;
@@ -907,6 +1156,13 @@ private:
             const bool allow = HitTest(rootWinBounds, p, UI::Size{3,3});
             mouseDragged |= w>1 || h>1;
             
+            // Allow scrolling while dragging, so that commits can be dropped at
+            // positions that aren't currently visible
+            if (const int dir = ev.mouseScroll()) {
+                UI::RevColumnPtr col = _columnHitTest(p);
+                if (col) _columnScroll(col, dir*_ScrollWheelCommits);
+            }
+            
             // Find insertion position
             ipos = _findInsertionPosition(p);
             
@@ -943,7 +1199,7 @@ private:
                     const bool copy = (ev.mouse.bstate & BUTTON_ALT) || forceCopy;
                     const bool copyPrev = _drag.copy;
                     _drag.copy = copy;
-                    _drag.titlePanel->header()->text(_drag.copy ? "Copy" : "Move");
+                    _drag.titlePanel->header()->text(_dragTitle());
                     if (_drag.copy != copyPrev) {
                         layoutNeeded(true);
                     }
@@ -952,7 +1208,7 @@ private:
                 // Position/size title panel / shadow panels
                 {
                     const UI::Point pos0 = p + mouseDownOffset + UI::Size{0,-1}; // -1 to account for the additional header line while dragging
-                    const UI::Size size = _drag.titlePanel->sizeIntrinsic({titlePanel->size().x, ConstraintNone});
+                    const UI::Size size = _drag.titlePanel->sizeIntrinsic({mouseDownPanelFrame.size.x, ConstraintNone});
                     _drag.titlePanel->frame({pos0, size});
                     
                     // Position/size shadowPanels
@@ -980,6 +1236,12 @@ private:
                 } else {
                     _drag.insertionMarker = std::nullopt;
                 }
+                
+                // Start computing the result of dropping at the insertion position, so
+                // that it's ready (or known to conflict) by the time the mouse is released
+                _drag.op = (ipos ? std::optional<_GitOp>(_dragOp(*ipos)) : std::nullopt);
+                _dragSpeculate();
+                _dragConflictUpdate();
             }
             
             eraseNeeded(true); // Need to erase the insertion marker
@@ -994,18 +1256,7 @@ private:
         std::optional<_GitOp> gitOp;
         if (!abort) {
             if (_drag.titlePanel && ipos) {
-                Git::Commit dstCommit = ((ipos->iter != ipos->col->panels().end()) ? (*ipos->iter)->commit() : nullptr);
-                gitOp = _GitOp{
-                    .type = (_drag.copy ? _GitOp::Type::Copy : _GitOp::Type::Move),
-                    .src = {
-                        .rev = _selection.rev,
-                        .commits = _selection.commits,
-                    },
-                    .dst = {
-                        .rev = ipos->col->rev(),
-                        .position = dstCommit,
-                    }
-                };
+                gitOp = _drag.op;
             
             // If this was a mouse-down + mouse-up without dragging in between,
             // set the selection to the commit that was clicked
@@ -1017,7 +1268,7 @@ private:
                 
                 auto currentTime = std::chrono::steady_clock::now();
                 const Rev& rev = _selection.rev;
-                const Git::Commit& commit = *_selection.commits.begin();
+                const Git::Commit commit = _repo.commitLookup(*_selection.commits.begin());
                 const bool doubleClicked =
                     doubleClickStatePrev.rev                                            &&
                     doubleClickStatePrev.rev==rev                                       &&
@@ -1043,7 +1294,7 @@ private:
                 
                 _doubleClickState = {
                     .rev = _selection.rev,
-                    .commit = *_selection.commits.begin(),
+                    .commit = commit,
                     .mouseUpOrigin = ev.mouse.origin,
                     .mouseUpTime = currentTime,
                 };
@@ -1056,6 +1307,8 @@ private:
         // We need one more erase to erase the insertion marker
         eraseNeeded(true);
         _drag = {};
+        // The speculated result of the drop is taken by _gitOpExec(); forget the rest
+        if (!gitOp && _dropSpeculator) _dropSpeculator->clear();
         
         return gitOp;
     }
@@ -1104,11 +1357,10 @@ private:
                     };
                     
                     // selection = _Selection XOR selectionNew
-                    std::set_symmetric_difference(
-                        selectionOld.commits.begin(), selectionOld.commits.end(),
-                        selectionNew.commits.begin(), selectionNew.commits.end(),
-                        std::inserter(selection.commits, selection.commits.begin())
-                    );
+                    selection.commits = selectionOld.commits;
+                    for (const Git::Id& commit : selectionNew.commits) {
+                        if (!selection.commits.erase(commit)) selection.commits.insert(commit);
+                    }
                     
                     _selection = selection;
                 
@@ -1306,7 +1558,7 @@ private:
             assert(_selection.commits.size() == 1);
             menu = nullptr;
             const Rev& rev = mouseDownColumn->rev();
-            const Git::Commit& commit = *_selection.commits.begin();
+            const Git::Commit commit = _repo.commitLookup(*_selection.commits.begin());
             _revCreate(_RevCreateType::Branch, rev, commit);
         
         } else if (menuButton == combineButton.get()) {
@@ -1427,12 +1679,9 @@ private:
         try {
             (Git::Rev&)rev = _refStateRestore(rev.ref, refState.refState);
             
-            const std::set<Git::Commit> selection = State::Convert(_repo,
-                (undo ? refStatePrev.selectionPrev : refState.selection));
-            
             _selection = {
                 .rev = rev,
-                .commits = selection,
+                .commits = (undo ? refStatePrev.selectionPrev : refState.selection),
             };
             
             // Re-get `h` (the history) here!
@@ -1454,29 +1703,200 @@ private:
         _reload();
     }
     
+    // _GitRevForRepo(): returns `rev` with its ref and commit looked up in `repo`
+    static Git::Rev _GitRevForRepo(const Git::Repo& repo, const Git::Rev& rev) {
+        Git::Rev r = rev;
+        if (rev.ref) r.ref = repo.refReload(rev.ref);
+        r.commit = repo.commitLookup(rev.commit.id());
+        return r;
+    }
+    
+    // _GitOpForRepo(): returns `op` with its revs and commits looked up in `repo`
+    static _GitOp _GitOpForRepo(const Git::Repo& repo, const _GitOp& op) {
+        _GitOp r = op;
+        if (op.src.rev) (Git::Rev&)r.src.rev = _GitRevForRepo(repo, op.src.rev);
+        if (op.dst.rev) (Git::Rev&)r.dst.rev = _GitRevForRepo(repo, op.dst.rev);
+        if (op.dst.position) r.dst.position = repo.commitLookup(op.dst.position.id());
+        return r;
+    }
+    
+    // _gitOpUICall(): called on the git op thread; performs `fn` on the UI thread and
+    // waits for it to complete, rethrowing any exception that it threw
+    void _gitOpUICall(_GitOpThread& t, std::function<void()> fn) {
+        auto lock = std::unique_lock(t.lock);
+        t.uiCall = fn;
+        t.uiCallErr = nullptr;
+        t.signal.notify_all();
+        t.signal.wait(lock, [&] { return !t.uiCall || t.abandon; });
+        if (t.uiCall) throw _GitModify::Canceled();
+        if (t.uiCallErr) std::rethrow_exception(t.uiCallErr);
+    }
+    
+    // _gitOpCancelCheck(): called on the git op thread; throws if the user canceled the operation
+    void _gitOpCancelCheck(_GitOpThread& t) {
+        auto lock = std::unique_lock(t.lock);
+        if (t.cancel) throw _GitModify::Canceled();
+    }
+    
+    // _gitOpWait(): services the git op thread's UI calls until the operation is done,
+    // showing its progress once it's taken long enough to be noticeable
+    void _gitOpWait(_GitOpThread& t) {
+        using namespace std::chrono;
+        const Deadline progressDeadline = steady_clock::now()+_GitOpProgressDelay;
+        std::optional<_PanelPresenter<UI::AlertPtr>> alert;
+        for (;;) {
+            std::function<void()> uiCall;
+            size_t progressIdx = 0;
+            size_t progressCount = 0;
+            bool cancel = false;
+            {
+                auto lock = std::unique_lock(t.lock);
+                // Until the progress alert is shown, there's nothing to do until the thread needs us
+                if (!alert) t.signal.wait_until(lock, progressDeadline, [&] { return t.done || t.uiCall; });
+                if (t.done) return;
+                uiCall = t.uiCall;
+                progressIdx = t.progressIdx;
+                progressCount = t.progressCount;
+                cancel = t.cancel;
+            }
+            
+            if (uiCall) {
+                std::exception_ptr err;
+                try {
+                    uiCall();
+                } catch (...) {
+                    err = std::current_exception();
+                }
+                
+                {
+                    auto lock = std::unique_lock(t.lock);
+                    t.uiCall = nullptr;
+                    t.uiCallErr = err;
+                }
+                t.signal.notify_all();
+                continue;
+            }
+            
+            if (!alert) {
+                alert.emplace(_panelPresent<UI::Alert>());
+                (*alert)->width                         (30);
+                (*alert)->color                         (colors().menu);
+                (*alert)->dismissButton()->action       ( [&] (UI::Button&) {
+                    auto lock = std::unique_lock(t.lock);
+                    t.cancel = true;
+                });
+            }
+            
+            std::string msg;
+            if (cancel)             msg = "Canceling...";
+            else if (progressCount) msg = "Rewriting " + std::to_string(progressIdx) + "/" + std::to_string(progressCount);
+            else                    msg = "Rewriting...";
+            (*alert)->message()->text(msg);
+            
+            try {
+                track(steady_clock::now()+_GitOpPollInterval);
+            
+            } catch (const UI::ExitRequest&) {
+                // Cancel the operation, and let our caller exit once the thread is done, so
+                // that we never exit between the thread's ref replacements
+                auto lock = std::unique_lock(t.lock);
+                t.cancel = true;
+                t.exit = true;
+            }
+        }
+    }
+    
     void _gitOpExec(const _GitOp& gitOp) {
+        const Trace::Span trace("App::_gitOpExec");
+        // Execute the operation on a separate thread, so that the UI stays responsive
+        // and can show the operation's progress. The thread uses its own repository
+        // handle, since libgit2 handles can't be shared between threads, and hands
+        // everything that involves the UI or our state (replacing refs, running the
+        // editor, prompting for conflict resolution) back to the UI thread.
+        //
+        // If the operation was a drop whose result was already computed while dragging,
+        // the thread only needs to finish it, using the repository handle that computed it.
+        std::optional<DropSpeculator::Result> spec = (_dropSpeculator ? _dropSpeculator->take(gitOp) : std::nullopt);
+        if (_dropSpeculator) _dropSpeculator->clear();
+        
+        const Git::Repo repo = (spec ? spec->repo : _repo.reopen());
+        const _GitOp op = _GitOpForRepo(repo, gitOp);
+        _GitOpThread t;
+        std::optional<_GitModify::OpResult> opResult;
+        std::exception_ptr err;
+        
         const _GitModify::Ctx ctx = {
-            .repo = _repo,
-            .refReplace = [&] (const Git::Ref& ref, const Git::Commit& commit) { return _gitRefReplace(ref, commit); },
-            .spawn = [&] (const char*const* argv) { _gitSpawn(argv); },
-            .conflictsResolve = [&] (const Git::Index& index, const std::vector<Git::Conflict>& fcs) { _gitConflictsResolve(gitOp, index, fcs); },
+            .repo = repo,
+            .refReplace = [&] (const Git::Ref& ref, const Git::Commit& commit) {
+                const std::string name = ref.fullName();
+                const Git::Id id = commit.id();
+                _gitOpUICall(t, [&] { _gitRefReplace(_repo.refFullNameLookup(name), _repo.commitLookup(id)); });
+                return repo.refFullNameLookup(name);
+            },
+            .spawn = [&] (const char*const* argv) { _gitOpUICall(t, [&] { _gitSpawn(argv); }); },
+            .conflictsResolve = [&] (const Git::Index& index, Git::ConflictStream& fcs) { _gitConflictsResolve(t, gitOp, repo, index, fcs); },
+            .progress = [&] (size_t idx, size_t count) {
+                auto lock = std::unique_lock(t.lock);
+                if (t.cancel) throw _GitModify::Canceled();
+                t.progressIdx = idx;
+                t.progressCount = count;
+            },
+            .mergeCache = _mergeCache,
         };
         
-        auto opResult = _GitModify::Exec(ctx, gitOp);
-        if (!opResult) return;
+        std::thread thread([&] {
+            Trace::ThreadName("git op");
+            try {
+                if (spec) opResult = _GitModify::Finish(ctx, std::move(spec->prepared));
+                else      opResult = _GitModify::Exec(ctx, op);
+            } catch (...) {
+                err = std::current_exception();
+            }
+            
+            {
+                auto lock = std::unique_lock(t.lock);
+                t.done = true;
+            }
+            t.signal.notify_all();
+        });
+        
+        // Stop the thread if we bail before it's done
+        Defer(
+            {
+                auto lock = std::unique_lock(t.lock);
+                t.cancel = true;
+                t.abandon = true;
+            }
+            t.signal.notify_all();
+            if (thread.joinable()) thread.join();
+        );
+        
+        _gitOpWait(t);
+        thread.join();
+        if (err) std::rethrow_exception(err);
+        
+        if (opResult) _gitOpResultApply(gitOp, *opResult);
+        if (t.exit) throw UI::ExitRequest();
+    }
+    
+    void _gitOpResultApply(const _GitOp& gitOp, _GitModify::OpResult opResult) {
+        // Look up the result's revs in our repository, since they were created by the
+        // git op thread's repository
+        if (opResult.src.rev) (Git::Rev&)opResult.src.rev = _GitRevForRepo(_repo, opResult.src.rev);
+        if (opResult.dst.rev) (Git::Rev&)opResult.dst.rev = _GitRevForRepo(_repo, opResult.dst.rev);
         
         Rev srcRevPrev = gitOp.src.rev;
         Rev dstRevPrev = gitOp.dst.rev;
-        Rev srcRev = opResult->src.rev;
-        Rev dstRev = opResult->dst.rev;
+        Rev srcRev = opResult.src.rev;
+        Rev dstRev = opResult.dst.rev;
         assert((bool)srcRev.ref == (bool)srcRevPrev.ref);
         assert((bool)dstRev.ref == (bool)dstRevPrev.ref);
         
         State::History* srcHistory = (srcRev.ref ? &_repoState.history(srcRev.ref) : nullptr);
         if (srcHistory && srcRev.commit!=srcRevPrev.commit) {
             State::HistoryRefState refState(srcRev.ref);
-            refState.selection = State::Convert(opResult->src.selection);
-            refState.selectionPrev = State::Convert(opResult->src.selectionPrev);
+            refState.selection = opResult.src.selection;
+            refState.selectionPrev = opResult.src.selectionPrev;
             srcHistory->push(refState);
             // We made a modification -- push the initial snapshot
             _repoState.snapshotInitialPush(srcRev.ref);
@@ -1485,24 +1905,24 @@ private:
         State::History* dstHistory = (dstRev.ref ? &_repoState.history(dstRev.ref) : nullptr);
         if (dstHistory && dstRev.commit!=dstRevPrev.commit) {
             State::HistoryRefState refState(dstRev.ref);
-            refState.selection = State::Convert(opResult->dst.selection);
-            refState.selectionPrev = State::Convert(opResult->dst.selectionPrev);
+            refState.selection = opResult.dst.selection;
+            refState.selectionPrev = opResult.dst.selectionPrev;
             dstHistory->push(refState);
             // We made a modification -- push the initial snapshot
             _repoState.snapshotInitialPush(dstRev.ref);
         }
         
         // Update the selection
-        if (opResult->dst.rev) {
+        if (opResult.dst.rev) {
             _selection = {
-                .rev = opResult->dst.rev,
-                .commits = opResult->dst.selection,
+                .rev = opResult.dst.rev,
+                .commits = opResult.dst.selection,
             };
         
         } else {
             _selection = {
-                .rev = opResult->src.rev,
-                .commits = opResult->src.selection,
+                .rev = opResult.src.rev,
+                .commits = opResult.src.selection,
             };
         }
         
@@ -1729,11 +2149,11 @@ private:
     
     std::optional<std::string> _gitRunConflictPanel(
         UI::ConflictPanel::Layout layout,
-        size_t conflictIdx, size_t conflictCount,
+        size_t conflictIdx, std::optional<size_t> conflictCount,
         const Rev& revOurs, const Rev& revTheirs,
         const Git::Conflict& fc) {
         
-        std::vector<std::string> lines;
+        std::vector<std::string_view> lines;
         for (size_t i=0; i<fc.hunks.size(); i++) {
             const Git::Conflict::Hunk& hunk = fc.hunks[i];
             
@@ -1745,7 +2165,9 @@ private:
             
             const auto& linesOurs = hunk.conflict.linesOurs;
             const auto& linesTheirs = hunk.conflict.linesTheirs;
-            const std::string title = "Conflict [" + std::to_string(conflictIdx+1) + "/" + std::to_string(conflictCount) + "]";
+            // The total is unknown until every conflict has been extracted
+            const std::string title = "Conflict [" + std::to_string(conflictIdx+1) +
+                (conflictCount ? "/" + std::to_string(*conflictCount) : "") + "]";
             auto panel = _panelPresent<UI::ConflictPanel>(
                 layout, title,
                 revOurs.displayName(), revTheirs.displayName(),
@@ -1805,41 +2227,116 @@ private:
         }
         
         if (lines.empty()) return std::nullopt;
-        return Toastbox::String::Join(lines, "\n");
+        return Git::LinesJoin(lines);
+    }
+    
+    // _gitConflictPrompt(): called on the git op thread; prompts the user to resolve the
+    // conflicts within `fc` on the UI thread, and returns the resolved content
+    std::optional<std::string> _gitConflictPrompt(_GitOpThread& t, const _GitOp& op,
+        size_t conflictIdx, std::optional<size_t> conflictCount, const Git::Conflict& fc) {
+        
+        std::optional<std::string> content;
+        _gitOpUICall(t, [&] {
+            // op.dst.rev is optional (depending on the git operation), so if it doesn't exist,
+            // fallback to op.src.rev (which is required)
+            const Rev revOurs = (op.dst.rev ? op.dst.rev : op.src.rev);
+            const Rev revTheirs = op.src.rev;
+            
+            // Determine the conflict panel layout (ie which rev is on the left vs right)
+            UI::ConflictPanel::Layout layout = UI::ConflictPanel::Layout::LeftOurs;
+            for (const Rev& rev : _revs) {
+                if (rev == revOurs) {
+                    layout = UI::ConflictPanel::Layout::LeftOurs;
+                    break;
+                } else if (rev == revTheirs) {
+                    layout = UI::ConflictPanel::Layout::RightOurs;
+                    break;
+                }
+            }
+            
+            content = _gitRunConflictPanel(layout, conflictIdx, conflictCount, revOurs, revTheirs, fc);
+        });
+        return content;
     }
     
-    void _gitConflictsResolve(const _GitOp& op, const Git::Index& index, const std::vector<Git::Conflict>& fcs) {
-        // op.dst.rev is optional (depending on the git operation), so if it doesn't exist,
-        // fallback to op.src.rev (which is required)
-        const Rev revOurs = (op.dst.rev ? op.dst.rev : op.src.rev);
-        const Rev revTheirs = op.src.rev;
-//        std::string refNameOurs = op.dst.rev.displayName();
-//        std::string refNameTheirs = op.src.rev.displayName();
+    // _gitConflictsResolve(): called on the git op thread; prompts the user to resolve
+    // each conflict on the UI thread, and applies the resolutions to `index`
+    //
+    // Each conflict is shown as soon as it's extracted, while the rest are extracted in
+    // the background. The resolutions are applied once they've all been extracted,
+    // since `index` and the object database can't be modified until then.
+    //
+    // Conflicts that were resolved before (eg before an undo+redo) are resolved the same
+    // way without prompting, and the user is offered to review them afterwards.
+    void _gitConflictsResolve(_GitOpThread& t, const _GitOp& op, const Git::Repo& repo,
+        const Git::Index& index, Git::ConflictStream& fcs) {
+        
+        std::vector<std::optional<std::string>> contents;
+        std::vector<size_t> conflictIdxs; // Index of each file's first conflict
+        std::vector<size_t> autoResolved; // Files resolved via `_resolutionCache`
+        std::optional<size_t> conflictCount;
+        // Counts the total number of conflicts, once they're all available
+        auto conflictCountUpdate = [&] {
+            if (conflictCount || !fcs.done()) return;
+            conflictCount = 0;
+            for (size_t i=0; i<fcs.size(); i++) *conflictCount += fcs.get(i).conflictCount();
+        };
         
-        // Determine the conflict panel layout (ie which rev is on the left vs right)
-        UI::ConflictPanel::Layout layout = UI::ConflictPanel::Layout::LeftOurs;
-        for (const Rev& rev : _revs) {
-            if (rev == revOurs) {
-                layout = UI::ConflictPanel::Layout::LeftOurs;
-                break;
-            } else if (rev == revTheirs) {
-                layout = UI::ConflictPanel::Layout::RightOurs;
-                break;
+        size_t conflictIdx = 0;
+        for (size_t i=0; i<fcs.size(); i++) {
+            const Git::Conflict& fc = fcs.get(i);
+            // Don't prompt if the user already canceled the operation
+            _gitOpCancelCheck(t);
+            conflictCountUpdate();
+            
+            conflictIdxs.push_back(conflictIdx);
+            conflictIdx += fc.conflictCount();
+            
+            if (std::optional<State::ResolutionCache::Resolution> res = _resolutionCache.get(fc)) {
+                contents.push_back(std::move(*res));
+                autoResolved.push_back(i);
+                continue;
             }
+            
+            contents.push_back(_gitConflictPrompt(t, op, conflictIdxs.back(), conflictCount, fc));
+            _resolutionCache.set(fc, contents.back());
         }
         
-        // Count the total number of conflict
-        size_t conflictCount = 0;
-        for (const Git::Conflict& fc : fcs) {
-            conflictCount += fc.conflictCount();
+        if (!autoResolved.empty()) {
+            std::vector<std::string> paths;
+            for (size_t i : autoResolved) paths.push_back(fcs.get(i).path);
+            
+            std::optional<bool> review;
+            _gitOpUICall(t, [&] {
+                auto alert = _panelPresent<UI::Alert>();
+                alert->width                            (50);
+                alert->color                            (colors().menu);
+                alert->title()->text                    ("Auto-resolved");
+                alert->message()->text                  ("Resolved conflicts the same way as before in: " +
+                                                         Toastbox::String::Join(paths, ", "));
+                alert->okButton()->label()->text        ("OK");
+                alert->dismissButton()->label()->text   ("Review");
+                alert->okButton()->action               ( [&] (UI::Button&) { review = false; } );
+                alert->dismissButton()->action          ( [&] (UI::Button&) { review = true; } );
+                
+                // Wait until the user clicks a button
+                while (!review) track(Once);
+            });
+            
+            if (*review) {
+                // Every conflict has been extracted by now, so the total is known
+                conflictCountUpdate();
+                for (size_t i : autoResolved) {
+                    const Git::Conflict& fc = fcs.get(i);
+                    contents[i] = _gitConflictPrompt(t, op, conflictIdxs[i], conflictCount, fc);
+                    _resolutionCache.set(fc, contents[i]);
+                }
+            }
         }
         
-        // Show the conflict panel for each hunk within each Conflict
-        size_t conflictIdx = 0;
-        for (const Git::Conflict& fc : fcs) {
-            const std::optional<std::string> content = _gitRunConflictPanel(layout, conflictIdx, conflictCount, revOurs, revTheirs, fc);
-            Git::ConflictResolve(_repo, index, fc, content);
-            conflictIdx += fc.conflictCount();
+        fcs.wait();
+        for (size_t i=0; i<fcs.size(); i++) {
+            Git::ConflictResolve(repo, index, fcs.get(i), contents[i]);
         }
     }
     
@@ -1877,10 +2374,7 @@ private:
         namespace fs = std::filesystem;
         
         // Short-circuit if we've already asked the user to move this version (or a newer version) of debase
-        {
-            State::State state(StateDir());
-            if (state.lastMoveOfferVersion() >= DebaseVersion) return;
-        }
+        if (!_moveOfferNeeded) return;
         
         _Path currentExecutablePath;
         try {
@@ -2071,8 +2565,12 @@ private:
     std::vector<Rev> _revs;
     
     State::RepoState _repoState;
+    State::ResolutionCache _resolutionCache;
     Git::Rev _head;
+    Git::Tree _headTree; // HEAD's tree when we started
     bool _headReattach = false;
+    std::future<bool> _dirtyCheck;
+    bool _moveOfferNeeded = false;
     std::vector<UI::RevColumnPtr> _columns;
     UI::RevColumnPtr _columnNameFocused;
     State::Theme _theme = State::Theme::None;
@@ -2082,8 +2580,13 @@ private:
         std::vector<UI::PanelPtr> shadowPanels;
         std::optional<UI::Rect> insertionMarker;
         bool copy = false;
+        std::optional<_GitOp> op; // The operation that dropping at the insertion position performs
+        bool conflict = false; // Whether `op` is known to conflict
     } _drag;
     
+    DropSpeculatorPtr _dropSpeculator;
+    Git::MergeCachePtr _mergeCache = std::make_shared<Git::MergeCache>();
+    
     struct {
         Rev rev;
         Git::Commit commit;
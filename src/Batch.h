@@ -0,0 +1,301 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include "git/Git.h"
+#include "git/Modify.h"
+#include "git/Conflict.h"
+#include "state/StateDir.h"
+#include "state/State.h"
+#include "lib/toastbox/String.h"
+#include "lib/nlohmann/json.h"
+#include "Rev.h"
+
+// Batch: applies operations read from a stream without the TUI, for `debase --batch`
+//
+// Each input line is a JSON object describing one operation:
+//
+//   {"op":"move",    "src":"<rev>", "commits":["<id>",...], "dst":"<rev>", "position":"<id>"}
+//   {"op":"copy",    "src":"<rev>", "commits":["<id>",...], "dst":"<rev>", "position":"<id>"}
+//   {"op":"delete",  "src":"<rev>", "commits":["<id>",...]}
+//   {"op":"combine", "src":"<rev>", "commits":["<id>",...]}
+//   {"op":"edit",    "src":"<rev>", "commits":["<id>"], "message":"...", "author":"Name <email>", "date":"..."}
+//
+// For move/copy, `dst` defaults to `src` and `position` defaults to the head of `dst`.
+// Conflicts are resolved according to the "conflicts" field: "fail" (the default) fails
+// the operation, while "ours" / "theirs" take that side of every conflict.
+//
+// The operations are applied in order, and each one's result is printed as a JSON
+// object on its own line. Modifications are recorded in the repository's debase state
+// exactly like the TUI does, so they can be undone from debase later.
+class Batch {
+public:
+    Batch(Git::Repo repo) : _repo(repo) {}
+    
+    // run(): applies the operations read from `in` and prints their results to `out`;
+    // returns whether every operation succeeded
+    bool run(std::istream& in, std::ostream& out) {
+        // Read every operation up front, so that we can load the state of all the refs
+        // that they touch in one go
+        std::vector<_Line> lines;
+        std::set<Git::Ref> refs;
+        std::string str;
+        for (size_t num=1; std::getline(in, str); num++) {
+            if (Toastbox::String::Trim(str).empty()) continue;
+            _Line& line = lines.emplace_back(_Line{.num = num});
+            try {
+                line.json = _Json::parse(str);
+                if (!line.json.is_object()) throw Toastbox::RuntimeError("operation must be a JSON object");
+                for (const char* key : {"src", "dst"}) {
+                    if (!line.json.contains(key)) continue;
+                    const Git::Rev rev = _repo.revLookup(line.json.at(key).get<std::string>());
+                    if (rev.ref) refs.insert(rev.ref);
+                }
+            } catch (const std::exception& e) {
+                line.error = e.what();
+            }
+        }
+        
+        _head = _repo.headResolved();
+        _headTree = _head.commit.tree();
+        _dirty = _repo.dirty();
+        _repoState = State::RepoState(StateDir(), _repo, refs);
+        State::MergeCacheRead(_repoState, *_mergeCache);
+        
+        // Reattach HEAD upon return, if we detached it
+        Defer(
+            if (_headReattach && _head) _repo.headAttach(_repo.revReload(_head), _headTree);
+        );
+        
+        bool ok = true;
+        for (const _Line& line : lines) {
+            _Json r = {{"line", line.num}};
+            try {
+                if (!line.error.empty()) throw Toastbox::RuntimeError("%s", line.error.c_str());
+                _exec(line.json, r);
+                r["ok"] = true;
+            
+            } catch (const std::exception& e) {
+                r["ok"] = false;
+                r["error"] = e.what();
+                ok = false;
+            }
+            out << r.dump() << std::endl;
+        }
+        
+        _repoState.write();
+        State::MergeCacheWrite(_repoState, *_mergeCache);
+        return ok;
+    }
+    
+private:
+    using _Json = nlohmann::json;
+    using _GitModify = Git::Modify<Rev>;
+    using _GitOp = _GitModify::Op;
+    
+    struct _Line {
+        size_t num = 0;
+        _Json json;
+        std::string error;
+    };
+    
+    static _GitOp::Type _OpTypeParse(const std::string& str) {
+        if (str == "move")      return _GitOp::Type::Move;
+        if (str == "copy")      return _GitOp::Type::Copy;
+        if (str == "delete")    return _GitOp::Type::Delete;
+        if (str == "combine")   return _GitOp::Type::Combine;
+        if (str == "edit")      return _GitOp::Type::Edit;
+        throw Toastbox::RuntimeError("invalid op: %s", str.c_str());
+    }
+    
+    static std::optional<Git::Conflict::Side> _ConflictSideParse(const std::string& str) {
+        if (str == "fail")      return std::nullopt;
+        if (str == "ours")      return Git::Conflict::Side::Ours;
+        if (str == "theirs")    return Git::Conflict::Side::Theirs;
+        throw Toastbox::RuntimeError("invalid conflict policy: %s", str.c_str());
+    }
+    
+    static _Json _JsonForIds(const Git::IdSet& ids) {
+        _Json r = _Json::array();
+        for (const Git::Id& id : ids) r.push_back(Git::StringFromId(id));
+        return r;
+    }
+    
+    // _EditorContent(): returns the commit message file `content`, with the fields
+    // supplied in `json` replaced
+    static std::string _EditorContent(std::string_view content, const _Json& json) {
+        constexpr const char AuthorPrefix[] = "Author:";
+        constexpr const char DatePrefix[]   = "Date:";
+        const std::vector<std::string> lines = Toastbox::String::Split(std::string(content), "\n");
+        
+        // The header (author+date) ends at the first empty line
+        std::string r;
+        auto iter = lines.begin();
+        for (; iter!=lines.end() && !Toastbox::String::Trim(*iter).empty(); iter++) {
+            if (json.contains("author") && Toastbox::String::StartsWith(AuthorPrefix, *iter)) {
+                r += std::string(AuthorPrefix) + " " + json.at("author").get<std::string>() + "\n";
+            } else if (json.contains("date") && Toastbox::String::StartsWith(DatePrefix, *iter)) {
+                r += std::string(DatePrefix) + "   " + json.at("date").get<std::string>() + "\n";
+            } else {
+                r += *iter + "\n";
+            }
+        }
+        
+        r += "\n";
+        if (json.contains("message")) {
+            r += json.at("message").get<std::string>();
+        } else if (iter != lines.end()) {
+            r += Toastbox::String::Join(std::vector<std::string>(iter+1, lines.end()), "\n");
+        }
+        return r;
+    }
+    
+    Rev _revLookup(const std::string& name) {
+        Rev rev;
+        (Git::Rev&)rev = _repo.revLookup(name);
+        // Prevent the checked-out branch from being modified if the repo has outstanding
+        // changes, since we can't clobber the uncommitted changes
+        if (_dirty && rev.ref && rev.ref==_head.ref) {
+            rev.mutability = Rev::Mutability::DisallowedUncommittedChanges;
+        }
+        return rev;
+    }
+    
+    static void _MutableCheck(const Rev& rev) {
+        if (rev.isMutable()) return;
+        if (rev.mutability == Rev::Mutability::DisallowedUncommittedChanges) {
+            throw Toastbox::RuntimeError("%s has uncommitted changes", rev.displayName().c_str());
+        }
+        throw Toastbox::RuntimeError("%s isn't a branch or tag", rev.displayName().c_str());
+    }
+    
+    void _exec(const _Json& json, _Json& r) {
+        _GitOp op = {
+            .type = _OpTypeParse(json.at("op").get<std::string>()),
+        };
+        
+        op.src.rev = _revLookup(json.at("src").get<std::string>());
+        for (const _Json& c : json.at("commits")) {
+            op.src.commits.insert(_repo.revLookup(c.get<std::string>()).commit.id());
+        }
+        if (op.src.commits.empty()) throw Toastbox::RuntimeError("no commits specified");
+        
+        const Git::FirstParentIndex srcIndex(op.src.rev.commit);
+        for (const Git::Id& id : op.src.commits) {
+            if (!srcIndex.depth(id)) {
+                throw Toastbox::RuntimeError("commit %s isn't in %s",
+                    Git::StringFromId(id).c_str(), op.src.rev.displayName().c_str());
+            }
+        }
+        
+        switch (op.type) {
+        case _GitOp::Type::Move:
+        case _GitOp::Type::Copy: {
+            op.dst.rev = (json.contains("dst") ? _revLookup(json.at("dst").get<std::string>()) : op.src.rev);
+            op.dst.position = (json.contains("position") ?
+                _repo.revLookup(json.at("position").get<std::string>()).commit : op.dst.rev.commit);
+            if (!Git::FirstParentIndex(op.dst.rev.commit).depth(op.dst.position)) {
+                throw Toastbox::RuntimeError("position isn't in %s", op.dst.rev.displayName().c_str());
+            }
+            if (op.type == _GitOp::Type::Move) _MutableCheck(op.src.rev);
+            _MutableCheck(op.dst.rev);
+            break;
+        }
+        
+        case _GitOp::Type::Combine:
+            if (op.src.commits.size() < 2) throw Toastbox::RuntimeError("combine requires at least 2 commits");
+            _MutableCheck(op.src.rev);
+            break;
+        
+        case _GitOp::Type::Edit:
+            if (op.src.commits.size() != 1) throw Toastbox::RuntimeError("edit requires exactly 1 commit");
+            _MutableCheck(op.src.rev);
+            break;
+        
+        default:
+            _MutableCheck(op.src.rev);
+            break;
+        }
+        
+        const std::optional<Git::Conflict::Side> conflictSide =
+            _ConflictSideParse(json.value("conflicts", std::string("fail")));
+        
+        const _GitModify::Ctx ctx = {
+            .repo = _repo,
+            .refReplace = [&] (const Git::Ref& ref, const Git::Commit& commit) {
+                // Detach HEAD if it's attached to the ref that we're modifying, otherwise
+                // we'll get an error when we try to replace that ref
+                if (ref == _head.ref && !_headReattach) {
+                    _headReattach = true;
+                    _repo.headDetach();
+                }
+                return _repo.refReplace(ref, commit);
+            },
+            // Stand in for the editor, by substituting the fields supplied in `json`
+            .spawn = [&] (const char*const* argv) {
+                const char* path = nullptr;
+                for (const char*const* a=argv; *a; a++) path = *a;
+                
+                std::stringstream ss;
+                {
+                    std::ifstream f(path);
+                    ss << f.rdbuf();
+                }
+                
+                std::ofstream f;
+                f.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+                f.open(path, std::ios::trunc);
+                f << _EditorContent(ss.str(), json);
+            },
+            .conflictsResolve = [&] (const Git::Index& index, Git::ConflictStream& stream) {
+                const std::vector<Git::Conflict> fcs = stream.all();
+                if (!conflictSide) {
+                    std::vector<std::string> paths;
+                    for (const Git::Conflict& fc : fcs) paths.push_back(fc.path);
+                    throw Toastbox::RuntimeError("merge conflict in: %s", Toastbox::String::Join(paths, ", ").c_str());
+                }
+                
+                for (const Git::Conflict& fc : fcs) {
+                    Git::ConflictResolve(_repo, index, fc, *conflictSide);
+                }
+            },
+            .mergeCache = _mergeCache,
+        };
+        
+        const std::optional<_GitModify::OpResult> opResult = _GitModify::Exec(ctx, op);
+        if (!opResult) {
+            r["nop"] = true;
+            return;
+        }
+        
+        _historyPush(op.src.rev, opResult->src);
+        _historyPush(op.dst.rev, opResult->dst);
+        
+        for (const auto& [key, res] : {std::pair("src", &opResult->src), std::pair("dst", &opResult->dst)}) {
+            if (!res->rev) continue;
+            r[key] = {
+                {"rev", (res->rev.ref ? res->rev.ref.fullName() : Git::StringFromId(res->rev.commit.id()))},
+                {"commit", Git::StringFromId(res->rev.commit.id())},
+                {"selection", _JsonForIds(res->selection)},
+            };
+        }
+    }
+    
+    // _historyPush(): records the modification of `revPrev` in the ref's history, like the TUI does
+    void _historyPush(const Rev& revPrev, const _GitModify::OpResult::Res& res) {
+        if (!res.rev.ref || res.rev.commit==revPrev.commit) return;
+        State::HistoryRefState refState(res.rev.ref);
+        refState.selection = res.selection;
+        refState.selectionPrev = res.selectionPrev;
+        _repoState.history(res.rev.ref).push(refState);
+        // We made a modification -- push the initial snapshot
+        _repoState.snapshotInitialPush(res.rev.ref);
+    }
+    
+    Git::Repo _repo;
+    Git::Rev _head;
+    Git::Tree _headTree;
+    bool _dirty = false;
+    bool _headReattach = false;
+    State::RepoState _repoState;
+    Git::MergeCachePtr _mergeCache = std::make_shared<Git::MergeCache>();
+};
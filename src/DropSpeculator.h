@@ -0,0 +1,286 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include "git/Git.h"
+#include "git/Modify.h"
+#include "Trace.h"
+#include "Rev.h"
+
+// DropSpeculator: computes the result of dropping the dragged commits on a background
+// thread, while the drag is still in progress
+//
+// Each speculation prepares the move/copy (see Git::Modify::Prepare()) on its own
+// repository handle, which is opened on our thread, without ever prompting: an operation
+// that would conflict is only recorded as such. Prepared operations are cached by their selection, destination
+// and position, so that a drop whose result is ready only needs to replace the refs.
+class DropSpeculator {
+public:
+    using Modify = Git::Modify<Rev>;
+    
+    enum class State {
+        Unknown,    // Not speculated
+        Pending,    // Being computed
+        Ready,      // Prepared; take() returns the result
+        Conflict,   // The operation conflicts, so it needs to be executed normally
+        Nop,        // The operation is a nop, or failed; it needs to be executed normally
+    };
+    
+    struct Result {
+        Git::Repo repo; // The repository handle that `prepared` was created with
+        Modify::Prepared prepared;
+    };
+    
+    // `repoPath` is the path of the repository whose operations we speculate
+    DropSpeculator(const std::filesystem::path& repoPath, Git::MergeCachePtr mergeCache) :
+    _repoPath(repoPath), _mergeCache(mergeCache) {
+        _thread = std::thread([=] { _threadRun(); });
+    }
+    
+    ~DropSpeculator() {
+        {
+            auto lock = std::unique_lock(_s.lock);
+            _s.stop = true;
+        }
+        _s.signal.notify_all();
+        _thread.join();
+    }
+    
+    DropSpeculator(const DropSpeculator&) = delete;
+    DropSpeculator& operator=(const DropSpeculator&) = delete;
+    
+    // state(): returns the state of the speculation for `op`
+    State state(const Modify::Op& op) {
+        const _Key key = _KeyForOp(op);
+        auto lock = std::unique_lock(_s.lock);
+        if (_s.request && *_s.request==key) return State::Pending;
+        if (_s.current && *_s.current==key) return State::Pending;
+        if (const _Entry* e = _entryFind(key)) return e->state;
+        return State::Unknown;
+    }
+    
+    // speculate(): starts computing the result of `op`, superseding the speculation in
+    // progress. Only `op`'s ids and ref names are handed to our thread, which looks
+    // them up in its own repository handle.
+    void speculate(const Modify::Op& op) {
+        {
+            auto lock = std::unique_lock(_s.lock);
+            _s.gen++;
+            _s.request = _KeyForOp(op);
+        }
+        _s.signal.notify_all();
+    }
+    
+    // take(): returns the prepared result for `op`, if it's ready
+    std::optional<Result> take(const Modify::Op& op) {
+        const _Key key = _KeyForOp(op);
+        auto lock = std::unique_lock(_s.lock);
+        for (auto it=_s.entries.begin(); it!=_s.entries.end(); it++) {
+            if (it->key!=key || !it->result) continue;
+            std::optional<Result> r = std::move(it->result);
+            _s.entries.erase(it);
+            return r;
+        }
+        return std::nullopt;
+    }
+    
+    // clear(): abandons the speculation in progress and forgets every result
+    void clear() {
+        std::deque<_Entry> entries;
+        std::optional<_Key> request;
+        {
+            auto lock = std::unique_lock(_s.lock);
+            _s.gen++;
+            std::swap(entries, _s.entries);
+            std::swap(request, _s.request);
+        }
+        // `entries` is destroyed without our lock held
+    }
+    
+private:
+    // Number of results to keep; each holds a repository handle and the objects that
+    // its operation created
+    static constexpr size_t _EntryCountMax = 4;
+    
+    // _RevKey: identifies a Rev without referencing any repository handle, so that it
+    // can be handed to our thread
+    struct _RevKey {
+        std::string ref; // Full name of the rev's ref, if any
+        Git::Id commit = {};
+        size_t skip = 0;
+        Rev::Mutability mutability = Rev::Mutability::Allowed;
+    
+        bool operator ==(const _RevKey& x) const {
+            return ref==x.ref && skip==x.skip && mutability==x.mutability &&
+                git_oid_equal(&commit, &x.commit);
+        }
+    };
+    
+    // _Key: identifies an operation, and holds everything needed to recreate it
+    struct _Key {
+        Modify::Op::Type type = Modify::Op::Type::None;
+        _RevKey src;
+        _RevKey dst;
+        Git::Id position = {};
+        Git::IdSet commits;
+        
+        bool operator ==(const _Key& x) const {
+            return type==x.type && src==x.src && dst==x.dst && commits==x.commits &&
+                git_oid_equal(&position, &x.position);
+        }
+        
+        bool operator !=(const _Key& x) const { return !(*this==x); }
+    };
+    
+    struct _Entry {
+        _Key key;
+        State state = State::Unknown;
+        std::optional<Result> result;
+    };
+    
+    static _RevKey _KeyForRev(const Rev& rev) {
+        if (!rev) return {};
+        return _RevKey{
+            .ref = (rev.ref ? rev.ref.fullName() : ""),
+            .commit = rev.commit.id(),
+            .skip = rev.skip,
+            .mutability = rev.mutability,
+        };
+    }
+    
+    static _Key _KeyForOp(const Modify::Op& op) {
+        _Key r = {
+            .type = op.type,
+            .src = _KeyForRev(op.src.rev),
+            .dst = _KeyForRev(op.dst.rev),
+            .commits = op.src.commits,
+        };
+        if (op.dst.position) r.position = op.dst.position.id();
+        return r;
+    }
+    
+    // _RevForKey(): returns the rev identified by `key`, looked up in `repo`
+    static Rev _RevForKey(const Git::Repo& repo, const _RevKey& key) {
+        if (git_oid_is_zero(&key.commit)) return {};
+        Rev r;
+        if (!key.ref.empty()) r.ref = repo.refFullNameLookup(key.ref);
+        r.commit = repo.commitLookup(key.commit);
+        r.skip = key.skip;
+        r.mutability = key.mutability;
+        return r;
+    }
+    
+    // _OpForKey(): returns the operation identified by `key`, looked up in `repo`
+    static Modify::Op _OpForKey(const Git::Repo& repo, const _Key& key) {
+        Modify::Op r = { .type = key.type };
+        r.src.rev = _RevForKey(repo, key.src);
+        r.src.commits = key.commits;
+        r.dst.rev = _RevForKey(repo, key.dst);
+        if (!git_oid_is_zero(&key.position)) r.dst.position = repo.commitLookup(key.position);
+        return r;
+    }
+    
+    // _entryFind(): must be called with our lock held
+    _Entry* _entryFind(const _Key& key) {
+        for (_Entry& e : _s.entries) {
+            if (e.key == key) return &e;
+        }
+        return nullptr;
+    }
+    
+    void _threadRun() {
+        Trace::ThreadName("drop speculator");
+        for (;;) {
+            _Key req;
+            uint64_t gen = 0;
+            {
+                auto lock = std::unique_lock(_s.lock);
+                _s.signal.wait(lock, [&] { return _s.stop || _s.request; });
+                if (_s.stop) return;
+                req = std::move(*_s.request);
+                gen = _s.gen;
+                _s.request = std::nullopt;
+                _s.current = req;
+            }
+            
+            _Entry entry = _speculate(req, gen);
+            
+            // The entry's result is destroyed without our lock held if it was superseded
+            std::deque<_Entry> evicted;
+            {
+                auto lock = std::unique_lock(_s.lock);
+                _s.current = std::nullopt;
+                if (gen != _s.gen) continue;
+                
+                _s.entries.push_back(std::move(entry));
+                while (_s.entries.size() > _EntryCountMax) {
+                    evicted.push_back(std::move(_s.entries.front()));
+                    _s.entries.pop_front();
+                }
+            }
+        }
+    }
+    
+    // _speculate(): prepares `req`'s operation on our thread
+    _Entry _speculate(const _Key& req, uint64_t gen) {
+        const Trace::Span trace("DropSpeculator::speculate");
+        _Entry r = {
+            .key = req,
+            .state = State::Nop,
+        };
+        
+        try {
+            // Each speculation needs its own handle, since its result holds on to it
+            const Git::Repo repo = Git::Repo::Open(_repoPath);
+            const Modify::Ctx ctx = {
+                .repo = repo,
+                // Prepare() never replaces refs, moves/copies never run the editor, and
+                // conflicts abort the speculation before they're extracted
+                .refReplace = [] (const Git::Ref&, const Git::Commit&) -> Git::Ref { abort(); },
+                .spawn = [] (const char*const*) { abort(); },
+                .conflictsResolve = [] (const Git::Index&, Git::ConflictStream&) { abort(); },
+                // Stop as soon as we're superseded
+                .progress = [&] (size_t, size_t) {
+                    auto lock = std::unique_lock(_s.lock);
+                    if (gen!=_s.gen || _s.stop) throw Modify::Canceled();
+                },
+                .mergeCache = _mergeCache,
+                .conflictsAbort = true,
+            };
+            
+            std::optional<Modify::Prepared> prepared = Modify::Prepare(ctx, _OpForKey(repo, req));
+            if (prepared) {
+                r.state = State::Ready;
+                r.result = Result{
+                    .repo = repo,
+                    .prepared = std::move(*prepared),
+                };
+            }
+        
+        } catch (const Modify::Conflicted&) {
+            r.state = State::Conflict;
+        
+        } catch (...) {
+            // Leave it to the drop itself to report the error
+        }
+        return r;
+    }
+    
+    const std::filesystem::path _repoPath;
+    const Git::MergeCachePtr _mergeCache;
+    std::thread _thread;
+    
+    // Shared between threads; protected by `lock`
+    struct {
+        std::mutex lock;
+        std::condition_variable signal;
+        uint64_t gen = 0;
+        std::optional<_Key> request;
+        std::optional<_Key> current; // Key of the speculation in progress
+        std::deque<_Entry> entries;
+        bool stop = false;
+    } _s;
+};
+
+using DropSpeculatorPtr = std::unique_ptr<DropSpeculator>;
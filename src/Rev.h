@@ -1,5 +1,6 @@
 #pragma once
 #include "git/Git.h"
+#include "git/FirstParentIndex.h"
 
 // Rev: wraps a Git::Rev to add additional functionality needed by debase:
 //   - skip: the number of commits to skip
@@ -46,13 +47,8 @@ public:
     // skip==0 -> return `commit`
     // skip>0  -> returns the `skip` parent of `commit`
     Git::Commit displayHead() const {
-        Git::Commit c = commit;
-        size_t s = skip;
-        while (c && s) {
-            c = c.parent();
-            s--;
-        }
-        return c;
+        if (!commit || !skip) return commit;
+        return Git::FirstParentIndex(commit).at(skip);
     }
     
 //    bool isMutable() const {
@@ -62,6 +58,7 @@ public:
     enum class Mutability {
         Allowed,
         DisallowedUncommittedChanges,
+        DisallowedUncommittedChangesCheck, // Still checking for uncommitted changes
     };
     
     bool isMutable() const {
@@ -0,0 +1,235 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <vector>
+#include <filesystem>
+#include <unistd.h>
+#include "lib/toastbox/RuntimeError.h"
+#include "lib/nlohmann/json.h"
+#include "lib/libgit2/include/git2.h"
+#include "lib/libgit2/include/git2/sys/odb_backend.h"
+
+// Trace: records timed, nested spans around debase's expensive phases (merges, index
+// writes, ref replacement, state writes, reloads), and writes them as Chrome
+// trace-event JSON, which can be loaded into ui.perfetto.dev or chrome://tracing.
+//
+// Tracing is disabled unless Start() is called (via `debase --trace <file>`), so that
+// Spans cost a single relaxed load otherwise. When enabled, each Span also records the
+// number of objects that its thread read from and wrote to the object database while
+// the span was open, and libgit2's own trace messages are recorded as instant events.
+namespace Trace {
+
+enum class Counter : size_t {
+    ObjectsRead,    // Objects read from an object database backend (ie object cache misses)
+    ObjectsWritten, // Objects written to an object database
+    BytesWritten,   // Uncompressed size of the objects written
+    Count,
+};
+
+using _Json = nlohmann::json;
+using _Counters = std::array<uint64_t,(size_t)Counter::Count>;
+
+inline std::atomic<bool> _Enabled = false;
+
+struct _State {
+    std::mutex lock;
+    std::filesystem::path path;
+    std::chrono::steady_clock::time_point epoch;
+    std::vector<_Json> events;
+    uint64_t tidNext = 0;
+};
+
+inline _State& _StateGet() {
+    static _State x;
+    return x;
+}
+
+// Counters are per-thread, so that a span only accounts for the work of its own thread
+inline thread_local _Counters _ThreadCounters = {};
+
+inline bool Enabled() {
+    return _Enabled.load(std::memory_order_relaxed);
+}
+
+inline void CounterAdd(Counter counter, uint64_t x) {
+    if (!Enabled()) return;
+    _ThreadCounters[(size_t)counter] += x;
+}
+
+inline const char* _CounterName(Counter counter) {
+    switch (counter) {
+    case Counter::ObjectsRead:      return "objectsRead";
+    case Counter::ObjectsWritten:   return "objectsWritten";
+    case Counter::BytesWritten:     return "bytesWritten";
+    default:                        abort();
+    }
+}
+
+// _Tid(): returns a small, stable id for the calling thread; must be called with `lock` held
+inline uint64_t _Tid(_State& state) {
+    static thread_local std::optional<uint64_t> tid;
+    if (!tid) tid = state.tidNext++;
+    return *tid;
+}
+
+inline int64_t _Timestamp(_State& state, std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(t-state.epoch).count();
+}
+
+inline void _EventRecord(_Json ev) {
+    _State& state = _StateGet();
+    auto lock = std::unique_lock(state.lock);
+    ev["pid"] = getpid();
+    ev["tid"] = _Tid(state);
+    state.events.push_back(std::move(ev));
+}
+
+// Span: records the time between its construction and destruction, along with the
+// counters that changed meanwhile. Spans on the same thread nest.
+class Span {
+public:
+    Span(const char* name) {
+        if (!Enabled()) return;
+        _name = name;
+        _start = std::chrono::steady_clock::now();
+        _counters = _ThreadCounters;
+    }
+    
+    ~Span() {
+        if (!_name) return;
+        const auto end = std::chrono::steady_clock::now();
+        
+        _Json args = _Json::object();
+        for (size_t i=0; i<(size_t)Counter::Count; i++) {
+            const uint64_t delta = _ThreadCounters[i]-_counters[i];
+            if (delta) args[_CounterName((Counter)i)] = delta;
+        }
+        
+        _State& state = _StateGet();
+        _EventRecord({
+            {"name", _name},
+            {"ph", "X"},
+            {"ts", _Timestamp(state, _start)},
+            {"dur", std::chrono::duration_cast<std::chrono::microseconds>(end-_start).count()},
+            {"args", args},
+        });
+    }
+    
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+    
+private:
+    const char* _name = nullptr;
+    std::chrono::steady_clock::time_point _start;
+    _Counters _counters = {};
+};
+
+// ThreadName(): names the calling thread in the trace
+inline void ThreadName(const char* name) {
+    if (!Enabled()) return;
+    _EventRecord({
+        {"name", "thread_name"},
+        {"ph", "M"},
+        {"args", {{"name", name}}},
+    });
+}
+
+inline void _GitTrace(git_trace_level_t level, const char* msg) {
+    _State& state = _StateGet();
+    _EventRecord({
+        {"name", "libgit2"},
+        {"ph", "i"},
+        {"s", "t"},
+        {"ts", _Timestamp(state, std::chrono::steady_clock::now())},
+        {"args", {{"level", (int)level}, {"message", msg}}},
+    });
+}
+
+// _OdbBackend: an object database backend that only counts the objects that pass
+// through it. It has the highest priority, so it sees every read that misses the
+// object cache and every write, and passes each one on to the real backends.
+struct _OdbBackend {
+    static constexpr int Priority = 2000;
+    
+    static int Read(void**, size_t*, git_object_t*, git_odb_backend*, const git_oid*) {
+        CounterAdd(Counter::ObjectsRead, 1);
+        return GIT_PASSTHROUGH;
+    }
+    
+    static int Write(git_odb_backend*, const git_oid*, const void*, size_t len, git_object_t) {
+        CounterAdd(Counter::ObjectsWritten, 1);
+        CounterAdd(Counter::BytesWritten, len);
+        return GIT_PASSTHROUGH;
+    }
+    
+    static int Foreach(git_odb_backend*, git_odb_foreach_cb, void*) {
+        return 0;
+    }
+    
+    static void Free(git_odb_backend* backend) {
+        delete backend;
+    }
+};
+
+// OdbAttach(): starts counting the objects read from and written to `odb`
+inline void OdbAttach(git_odb* odb) {
+    git_odb_backend* backend = new git_odb_backend{};
+    backend->version = GIT_ODB_BACKEND_VERSION;
+    backend->read = _OdbBackend::Read;
+    backend->write = _OdbBackend::Write;
+    backend->foreach = _OdbBackend::Foreach;
+    backend->free = _OdbBackend::Free;
+    
+    int ir = git_odb_add_backend(odb, backend, _OdbBackend::Priority);
+    if (ir) {
+        delete backend;
+        throw Toastbox::RuntimeError("git_odb_add_backend failed: %d", ir);
+    }
+}
+
+// Start(): starts recording a trace, which Stop() writes to `path`
+inline void Start(const std::filesystem::path& path) {
+    _State& state = _StateGet();
+    {
+        auto lock = std::unique_lock(state.lock);
+        state.path = path;
+        state.epoch = std::chrono::steady_clock::now();
+        state.events.clear();
+    }
+    _Enabled = true;
+    ThreadName("main");
+    
+    // libgit2 only supports tracing if it was built with GIT_TRACE, so this is
+    // best-effort
+    git_libgit2_init();
+    git_trace_set(GIT_TRACE_TRACE, _GitTrace);
+}
+
+// Stop(): stops recording and writes the trace, if one was started
+inline void Stop() {
+    if (!Enabled()) return;
+    git_trace_set(GIT_TRACE_NONE, nullptr);
+    git_libgit2_shutdown();
+    _Enabled = false;
+    
+    _State& state = _StateGet();
+    auto lock = std::unique_lock(state.lock);
+    std::ofstream f;
+    f.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+    try {
+        f.open(state.path);
+        f << _Json{
+            {"traceEvents", state.events},
+            {"displayTimeUnit", "ms"},
+        };
+        f.close();
+    } catch (const std::exception& e) {
+        throw Toastbox::RuntimeError("failed to write trace to %s: %s", state.path.c_str(), e.what());
+    }
+}
+
+} // namespace Trace
@@ -12,6 +12,29 @@ debase [<rev>...]
 
         git reflog | grep checkout:
 
+debase --trace <file> [<rev>...]
+    Open the specified git revisions in debase, and record a trace of
+    debase's git operations to <file>
+    
+    The trace uses the Chrome trace-event format, and can be viewed
+    with ui.perfetto.dev or chrome://tracing.
+
+debase --batch
+    Apply operations read from stdin, without the interactive interface
+    
+    Each line of stdin is a JSON object describing one operation, eg:
+        {"op":"move", "src":"master", "commits":["1a2b3c4"], "position":"5d6e7f8"}
+        {"op":"copy", "src":"master", "commits":["1a2b3c4"], "dst":"feature"}
+        {"op":"delete", "src":"master", "commits":["1a2b3c4","9a8b7c6"]}
+        {"op":"combine", "src":"master", "commits":["1a2b3c4","9a8b7c6"]}
+        {"op":"edit", "src":"master", "commits":["1a2b3c4"], "message":"..."}
+    
+    Edits also accept "author" and "date". Merge conflicts fail the
+    operation, unless "conflicts" is set to "ours" or "theirs".
+    
+    The result of each operation is printed as a JSON object on its own
+    line. Operations can be undone by opening the branch in debase.
+
 debase -h
 debase --help
     Print this help message
@@ -0,0 +1,131 @@
+#pragma once
+#include <map>
+#include <set>
+#include "git/Git.h"
+#include "git/ObjectStage.h"
+
+// SynthRepo: deterministically generates a synthetic repository for benchmarking
+//
+// The repository's content is modeled as a set of numbered files, which are laid out
+// in directories of _FilesPerDir files each. commit() snapshots the current content as
+// a commit, only rebuilding the trees of the directories that changed since the
+// previous commit, so that generating histories on top of wide trees is cheap.
+//
+// All objects are staged in memory while generating, and written as a single pack by
+// finish(), which is much faster than writing loose objects.
+class SynthRepo {
+public:
+    SynthRepo(const std::filesystem::path& path) {
+        git_libgit2_init();
+        Defer(git_libgit2_shutdown());
+        
+        git_repository* x = nullptr;
+        int ir = git_repository_init(&x, path.c_str(), false);
+        if (ir) throw Git::Error(ir, "git_repository_init failed");
+        git_repository_free(x);
+        
+        _repo = Git::Repo::Open(path);
+        _stage = std::make_unique<Git::ObjectStage>(_repo);
+    }
+    
+    const Git::Repo& repo() const { return _repo; }
+    
+    // file(): sets the content of file `idx`
+    void file(size_t idx, std::string_view content) {
+        const Git::Blob blob = _repo.blobCreate(content.data(), content.size());
+        const size_t dir = idx/_FilesPerDir;
+        _dirs[dir].files[idx%_FilesPerDir] = blob.id();
+        _dirs[dir].tree = std::nullopt;
+    }
+    
+    // commit(): creates a commit with the current content, and the given parents
+    Git::Commit commit(const std::vector<Git::Commit>& parents, const std::string& msg) {
+        // Use a fixed time that increases with each commit, so that the repository
+        // is identical across runs
+        const Git::Signature sig = Git::Signature::Create("Bench", "bench@debase", _TimeStart+_commitCount, 0);
+        _commitCount++;
+        
+        const Git::Tree tree = _repo.treeLookup(_treeWrite());
+        std::vector<const git_commit*> p;
+        for (const Git::Commit& c : parents) p.push_back(*c);
+        
+        Git::Id id;
+        int ir = git_commit_create(&id, *_repo, nullptr, *sig, *sig, nullptr, msg.c_str(), *tree, p.size(), p.data());
+        if (ir) throw Git::Error(ir, "git_commit_create failed");
+        return _repo.commitLookup(id);
+    }
+    
+    // branch(): sets branch `name` to `commit`; finish() creates the branches
+    void branch(const std::string& name, const Git::Commit& commit) {
+        _branches[name] = commit;
+    }
+    
+    // finish(): writes the generated objects to disk and creates the branches
+    void finish() {
+        std::vector<Git::Commit> heads;
+        for (const auto& [name, commit] : _branches) heads.push_back(commit);
+        _stage->write(heads);
+        _stage = nullptr;
+        
+        for (const auto& [name, commit] : _branches) {
+            _repo.branchCreate(name, _repo.commitLookup(commit.id()), false);
+        }
+        
+        // Detach HEAD (like debase does while it's running) so that the branches can
+        // be rewritten
+        if (!_branches.empty()) _repo.headDetach();
+    }
+    
+private:
+    static constexpr size_t _FilesPerDir = 1000;
+    static constexpr git_time_t _TimeStart = 1600000000;
+    
+    struct _Dir {
+        std::map<size_t,Git::Id> files;
+        std::optional<Git::Id> tree;
+    };
+    
+    static std::string _Name(const char* prefix, size_t idx) {
+        return prefix + std::to_string(idx);
+    }
+    
+    Git::Id _treeWrite() {
+        git_treebuilder* root = nullptr;
+        int ir = git_treebuilder_new(&root, *_repo, nullptr);
+        if (ir) throw Git::Error(ir, "git_treebuilder_new failed");
+        Defer(git_treebuilder_free(root));
+        
+        for (auto& [dirIdx, dir] : _dirs) {
+            if (!dir.tree) {
+                git_treebuilder* tb = nullptr;
+                ir = git_treebuilder_new(&tb, *_repo, nullptr);
+                if (ir) throw Git::Error(ir, "git_treebuilder_new failed");
+                Defer(git_treebuilder_free(tb));
+                
+                for (const auto& [fileIdx, blob] : dir.files) {
+                    ir = git_treebuilder_insert(nullptr, tb, _Name("f", dirIdx*_FilesPerDir+fileIdx).c_str(), &blob, GIT_FILEMODE_BLOB);
+                    if (ir) throw Git::Error(ir, "git_treebuilder_insert failed");
+                }
+                
+                Git::Id id;
+                ir = git_treebuilder_write(&id, tb);
+                if (ir) throw Git::Error(ir, "git_treebuilder_write failed");
+                dir.tree = id;
+            }
+            
+            ir = git_treebuilder_insert(nullptr, root, _Name("d", dirIdx).c_str(), &*dir.tree, GIT_FILEMODE_TREE);
+            if (ir) throw Git::Error(ir, "git_treebuilder_insert failed");
+        }
+        
+        Git::Id id;
+        ir = git_treebuilder_write(&id, root);
+        if (ir) throw Git::Error(ir, "git_treebuilder_write failed");
+        return id;
+    }
+    
+    Git::Repo _repo;
+    std::unique_ptr<Git::ObjectStage> _stage;
+    std::map<size_t,_Dir> _dirs;
+    std::map<std::string,Git::Commit> _branches;
+    size_t _commitCount = 0;
+};
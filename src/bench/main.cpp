@@ -0,0 +1,331 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <set>
+#include "lib/toastbox/RuntimeError.h"
+#include "lib/toastbox/Defer.h"
+#include "lib/nlohmann/json.h"
+#include "git/Git.h"
+#include "git/Modify.h"
+#include "git/FirstParentIndex.h"
+#include "Rev.h"
+#include "bench/SynthRepo.h"
+
+// debase-bench: headless benchmark of Git::Modify operations on synthetic repositories
+//
+// Usage: debase-bench [--quick] [--keep] [<scenario>...]
+//
+// Generates each scenario's repository in a temporary directory, times every operation
+// at a range of depths and selection sizes, and prints one JSON object per measurement
+// to stdout. Progress is printed to stderr.
+
+using _Modify = Git::Modify<Rev>;
+using _Json = nlohmann::json;
+using _Path = std::filesystem::path;
+
+struct _Options {
+    bool quick = false;
+    bool keep = false;
+    std::set<std::string> scenarios;
+};
+
+struct _Scenario {
+    const char* name;
+    std::function<void(SynthRepo&, const _Options&)> generate;
+};
+
+static std::string _Content(size_t file, size_t rev) {
+    return "file " + std::to_string(file) + " rev " + std::to_string(rev) + "\n";
+}
+
+// _LargeContent(): returns `lines` lines of deterministic pseudo-random text, with
+// line `changedLine` replaced to reflect `rev`
+static std::string _LargeContent(size_t file, size_t lines, size_t changedLine, size_t rev) {
+    std::string r;
+    uint64_t x = file+1;
+    for (size_t i=0; i<lines; i++) {
+        x = x*6364136223846793005ull + 1442695040888963407ull;
+        if (i == changedLine) r += "changed in rev " + std::to_string(rev) + "\n";
+        else                  r += std::to_string(x) + " " + std::to_string(x>>7) + " " + std::to_string(x>>13) + "\n";
+    }
+    return r;
+}
+
+// Deep linear history, where each commit adds a file
+static void _GenerateLinear(SynthRepo& repo, const _Options& opts) {
+    const size_t depth = (opts.quick ? 500 : 2000);
+    Git::Commit head;
+    for (size_t i=0; i<depth; i++) {
+        repo.file(i, _Content(i, 0));
+        head = repo.commit((head ? std::vector<Git::Commit>{head} : std::vector<Git::Commit>{}), "commit " + std::to_string(i));
+    }
+    repo.branch("master", head);
+}
+
+// Wide tree, where each commit modifies a different existing file
+static void _GenerateWide(SynthRepo& repo, const _Options& opts) {
+    const size_t files = (opts.quick ? 10000 : 100000);
+    const size_t depth = 200;
+    for (size_t i=0; i<files; i++) repo.file(i, _Content(i, 0));
+    Git::Commit head = repo.commit({}, "initial");
+    for (size_t i=0; i<depth; i++) {
+        const size_t file = (i*7919)%files;
+        repo.file(file, _Content(file, i+1));
+        head = repo.commit({head}, "commit " + std::to_string(i));
+    }
+    repo.branch("master", head);
+}
+
+// Large files, where each commit changes a different line of one of them
+static void _GenerateLarge(SynthRepo& repo, const _Options& opts) {
+    const size_t files = 8;
+    const size_t lines = (opts.quick ? 20000 : 80000); // ~1MB / ~4MB
+    const size_t depth = 100;
+    std::vector<size_t> changedLines(files, SIZE_MAX);
+    for (size_t f=0; f<files; f++) repo.file(f, _LargeContent(f, lines, SIZE_MAX, 0));
+    Git::Commit head = repo.commit({}, "initial");
+    for (size_t i=0; i<depth; i++) {
+        const size_t f = i%files;
+        changedLines[f] = ((i/files)*997 + 13)%lines;
+        repo.file(f, _LargeContent(f, lines, changedLines[f], i+1));
+        head = repo.commit({head}, "commit " + std::to_string(i));
+    }
+    repo.branch("master", head);
+}
+
+// Linear history with many refs pointing into it
+static void _GenerateRefs(SynthRepo& repo, const _Options& opts) {
+    const size_t depth = 1000;
+    const size_t refs = (opts.quick ? 1000 : 10000);
+    std::vector<Git::Commit> commits;
+    for (size_t i=0; i<depth; i++) {
+        repo.file(i, _Content(i, 0));
+        commits.push_back(repo.commit((i ? std::vector<Git::Commit>{commits.back()} : std::vector<Git::Commit>{}), "commit " + std::to_string(i)));
+    }
+    for (size_t i=0; i<refs; i++) {
+        repo.branch("ref/" + std::to_string(i), commits[(i*31)%depth]);
+    }
+    repo.branch("master", commits.back());
+}
+
+// First-parent history where every 10th commit merges a 3-commit side branch
+static void _GenerateMerges(SynthRepo& repo, const _Options& opts) {
+    const size_t depth = (opts.quick ? 300 : 1000);
+    size_t file = 0;
+    Git::Commit head;
+    for (size_t i=0; i<depth; i++) {
+        if (head && !(i%10)) {
+            Git::Commit side = head;
+            for (size_t s=0; s<3; s++) {
+                repo.file(file, _Content(file, 0));
+                file++;
+                side = repo.commit({side}, "side " + std::to_string(i) + "." + std::to_string(s));
+            }
+            head = repo.commit({head, side}, "merge " + std::to_string(i));
+            continue;
+        }
+        
+        repo.file(file, _Content(file, 0));
+        file++;
+        head = repo.commit((head ? std::vector<Git::Commit>{head} : std::vector<Git::Commit>{}), "commit " + std::to_string(i));
+    }
+    repo.branch("master", head);
+}
+
+static const _Scenario _Scenarios[] = {
+    { "linear", _GenerateLinear },
+    { "wide",   _GenerateWide   },
+    { "large",  _GenerateLarge  },
+    { "refs",   _GenerateRefs   },
+    { "merges", _GenerateMerges },
+};
+
+static Rev _RevLookup(const Git::Repo& repo, const std::string& name) {
+    Rev rev;
+    (Git::Rev&)rev = repo.revLookup(name);
+    return rev;
+}
+
+static const char* _OpName(_Modify::Op::Type type) {
+    switch (type) {
+    case _Modify::Op::Type::Move:       return "move";
+    case _Modify::Op::Type::Copy:       return "copy";
+    case _Modify::Op::Type::Delete:     return "delete";
+    case _Modify::Op::Type::Combine:    return "combine";
+    case _Modify::Op::Type::Edit:       return "edit";
+    default:                            abort();
+    }
+}
+
+// _Measure(): times `type` on `count` commits starting at `depth` below `master`, `runs`
+// times, restoring the refs before each run. Copies go to a branch at `root`.
+static _Json _Measure(const Git::Repo& repo, const Git::Commit& master, const Git::Commit& root,
+    const char* scenario, _Modify::Op::Type type, size_t depth, size_t count, size_t runs) {
+    
+    using namespace std::chrono;
+    
+    size_t rewritten = 0;
+    const _Modify::Ctx ctx = {
+        .repo = repo,
+        .refReplace = [&] (const Git::Ref& ref, const Git::Commit& commit) { return repo.refReplace(ref, commit); },
+        // Stand-in for the editor: amend the commit message
+        .spawn = [&] (const char*const* argv) {
+            const char* path = nullptr;
+            for (const char*const* a=argv; *a; a++) path = *a;
+            std::ofstream f(path, std::ios::app);
+            f << "\n(edited)";
+        },
+        // Resolve conflicts non-interactively, by choosing 'theirs'
+        .conflictsResolve = [&] (const Git::Index& index, Git::ConflictStream& fcs) {
+            for (const Git::Conflict& fc : fcs.all()) {
+                Git::ConflictResolve(repo, index, fc, Git::Conflict::Side::Theirs);
+            }
+        },
+        .progress = [&] (size_t idx, size_t count) { rewritten = count; },
+    };
+    
+    _Json r = {
+        {"scenario", scenario},
+        {"op", _OpName(type)},
+        {"depth", depth},
+        {"count", count},
+    };
+    
+    std::vector<double> ms;
+    for (size_t run=0; run<runs; run++) {
+        // Restore the refs
+        repo.refReplace(repo.refLookup("master"), master);
+        repo.branchCreate("bench-dst", root, true);
+        
+        _Modify::Op op = { .type = type };
+        op.src.rev = _RevLookup(repo, "master");
+        const Git::FirstParentIndex index(master);
+        for (size_t i=depth; i<depth+count; i++) op.src.commits.insert(index.at(i));
+        
+        switch (type) {
+        case _Modify::Op::Type::Move:
+            op.dst.rev = op.src.rev;
+            op.dst.position = master;
+            break;
+        case _Modify::Op::Type::Copy:
+            op.dst.rev = _RevLookup(repo, "bench-dst");
+            op.dst.position = op.dst.rev.commit;
+            break;
+        default:
+            break;
+        }
+        
+        try {
+            const auto start = steady_clock::now();
+            const std::optional<_Modify::OpResult> result = _Modify::Exec(ctx, op);
+            ms.push_back(duration<double,std::milli>(steady_clock::now()-start).count());
+            if (!result) throw Toastbox::RuntimeError("operation was a nop");
+        
+        } catch (const std::exception& e) {
+            r["error"] = e.what();
+            return r;
+        }
+    }
+    
+    std::sort(ms.begin(), ms.end());
+    r["rewritten"] = rewritten;
+    r["runs"] = runs;
+    r["ms"] = ms[ms.size()/2];
+    r["msMin"] = ms.front();
+    return r;
+}
+
+static void _Bench(const _Path& dir, const _Scenario& scenario, const _Options& opts) {
+    using namespace std::chrono;
+    const _Path path = dir / scenario.name;
+    
+    std::cerr << "Generating " << scenario.name << "..." << std::endl;
+    const auto start = steady_clock::now();
+    {
+        SynthRepo repo(path);
+        scenario.generate(repo, opts);
+        repo.finish();
+    }
+    std::cerr << "  took " << duration_cast<milliseconds>(steady_clock::now()-start).count() << " ms" << std::endl;
+    
+    const Git::Repo repo = Git::Repo::Open(path);
+    const Git::Commit master = repo.revLookup("master").commit;
+    const Git::FirstParentIndex index(master);
+    size_t historyDepth = 0;
+    while (index.at(historyDepth)) historyDepth++;
+    const Git::Commit root = index.at(historyDepth-1);
+    const size_t runs = (opts.quick ? 1 : 3);
+    const std::vector<size_t> depths = (opts.quick ? std::vector<size_t>{1, 10, 100} : std::vector<size_t>{1, 10, 100, 1000});
+    const std::vector<size_t> counts = {1, 10};
+    
+    const _Modify::Op::Type types[] = {
+        _Modify::Op::Type::Move,
+        _Modify::Op::Type::Copy,
+        _Modify::Op::Type::Delete,
+        _Modify::Op::Type::Combine,
+        _Modify::Op::Type::Edit,
+    };
+    
+    // mergeInRange(): whether any of the `count` commits starting at `depth` is a merge
+    const auto mergeInRange = [&] (size_t depth, size_t count) {
+        for (size_t i=depth; i<depth+count; i++) {
+            if (index.at(i).isMerge()) return true;
+        }
+        return false;
+    };
+    
+    for (_Modify::Op::Type type : types) {
+        for (size_t depth : depths) {
+            for (size_t count : counts) {
+                // Leave the root commit alone, so that deletes never empty the history
+                if (depth+count >= historyDepth) continue;
+                if (type==_Modify::Op::Type::Combine && count<2) continue;
+                // Merge commits can't be combined
+                if (type==_Modify::Op::Type::Combine && mergeInRange(depth, count)) continue;
+                if (type==_Modify::Op::Type::Edit && count!=1) continue;
+                
+                const _Json r = _Measure(repo, master, root, scenario.name, type, depth, count, runs);
+                std::cout << r.dump() << std::endl;
+            }
+        }
+    }
+}
+
+int main(int argc, const char* argv[]) {
+    try {
+        _Options opts;
+        for (int i=1; i<argc; i++) {
+            const std::string arg = argv[i];
+            if (arg == "--quick")       opts.quick = true;
+            else if (arg == "--keep")   opts.keep = true;
+            else                        opts.scenarios.insert(arg);
+        }
+        
+        for (const std::string& name : opts.scenarios) {
+            const bool found = std::any_of(std::begin(_Scenarios), std::end(_Scenarios),
+                [&] (const _Scenario& s) { return name==s.name; });
+            if (!found) throw Toastbox::RuntimeError("unknown scenario: %s", name.c_str());
+        }
+        
+        char tmp[] = "/tmp/debase-bench.XXXXXX";
+        if (!mkdtemp(tmp)) throw Toastbox::RuntimeError("mkdtemp failed: %s", strerror(errno));
+        const _Path dir = tmp;
+        Defer(
+            if (!opts.keep) std::filesystem::remove_all(dir);
+            else std::cerr << "Kept repositories in " << dir << std::endl;
+        );
+        
+        for (const _Scenario& scenario : _Scenarios) {
+            if (!opts.scenarios.empty() && !opts.scenarios.count(scenario.name)) continue;
+            _Bench(dir, scenario, opts);
+        }
+    
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+    
+    return 0;
+}
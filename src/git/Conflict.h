@@ -1,7 +1,11 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <map>
 #include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "Git.h"
 #include "lib/toastbox/String.h"
 
@@ -27,12 +31,12 @@ struct Conflict {
         Type type = Type::Normal;
         
         struct {
-            std::vector<std::string> lines;
+            std::vector<std::string_view> lines;
         } normal;
         
         struct {
-            std::vector<std::string> linesOurs;
-            std::vector<std::string> linesTheirs;
+            std::vector<std::string_view> linesOurs;
+            std::vector<std::string_view> linesTheirs;
         } conflict;
         
         bool empty() const {
@@ -43,7 +47,7 @@ struct Conflict {
             }
         }
         
-        const std::vector<std::string>& lines(Side side) const {
+        const std::vector<std::string_view>& lines(Side side) const {
             switch (type) {
             case Type::Normal:      return normal.lines;
             case Type::Conflict:
@@ -60,6 +64,9 @@ struct Conflict {
     Type type = Type::File;
     std::filesystem::path path;
     std::vector<Hunk> hunks;
+    // Owns the memory that the hunks' lines refer to (eg the merge output, or a blob),
+    // so that the lines don't need to be copied
+    std::shared_ptr<const void> buffer;
     
     // noFile(side): returns whether the given `side` of the conflict
     // represents a non-existent file
@@ -70,15 +77,25 @@ struct Conflict {
                 hunks[0].lines(side).empty();
     }
     
-    // content(side): returns the content for the given `side` of the conflict
-    std::optional<std::string> content(Side side) const {
-        if (noFile(side)) return std::nullopt;
-        std::vector<std::string> lines;
+    // contentWrite(side, fn): supplies the content for the given `side` of the conflict
+    // to `fn`, one piece at a time
+    template <typename T_Fn>
+    void contentWrite(Side side, T_Fn fn) const {
+        bool first = true;
         for (const Hunk& hunk : hunks) {
-            const auto& l = hunk.lines(side);
-            lines.insert(lines.end(), l.begin(), l.end());
+            for (std::string_view line : hunk.lines(side)) {
+                if (!first) fn(std::string_view("\n"));
+                fn(line);
+                first = false;
+            }
         }
-        return Toastbox::String::Join(lines, "\n");
+    }
+    
+    // contentSize(side): returns the size of the content for the given `side` of the conflict
+    size_t contentSize(Side side) const {
+        size_t r = 0;
+        contentWrite(side, [&] (std::string_view x) { r += x.size(); });
+        return r;
     }
     
     size_t conflictCount() const {
@@ -98,9 +115,46 @@ struct ConflictMarkers {
     const char* end       = nullptr;
 };
 
-inline std::vector<Conflict::Hunk> HunksFromConflictString(const ConflictMarkers& markers, std::string_view str) {
-    const std::vector<std::string> lines = Toastbox::String::Split(str, "\n");
+// _LinesForEach(): calls `fn` with each line of `str`, without copying them
+// The lines are split on newlines, so joining them with newlines reproduces `str`.
+// Stops early if `fn` returns false.
+template <typename T_Fn>
+inline void _LinesForEach(std::string_view str, T_Fn fn) {
+    for (size_t pos=0;;) {
+        const size_t end = str.find('\n', pos);
+        if (end == std::string_view::npos) {
+            fn(str.substr(pos));
+            return;
+        }
+        if (!fn(str.substr(pos, end-pos))) return;
+        pos = end+1;
+    }
+}
+
+// LinesSplit(): returns the lines of `str`, which refer to `str`'s memory
+inline std::vector<std::string_view> LinesSplit(std::string_view str) {
+    std::vector<std::string_view> r;
+    _LinesForEach(str, [&] (std::string_view line) { r.push_back(line); return true; });
+    return r;
+}
+
+// LinesJoin(): joins `lines` with newlines
+inline std::string LinesJoin(const std::vector<std::string_view>& lines) {
+    size_t len = 0;
+    for (std::string_view line : lines) len += line.size()+1;
     
+    std::string r;
+    r.reserve(len);
+    for (size_t i=0; i<lines.size(); i++) {
+        if (i) r += '\n';
+        r += lines[i];
+    }
+    return r;
+}
+
+// HunksFromConflictString(): parses the conflict markers in `str` in a single pass
+// The hunks' lines refer to `str`'s memory, so it must outlive them.
+inline std::vector<Conflict::Hunk> HunksFromConflictString(const ConflictMarkers& markers, std::string_view str) {
     enum class _ParseState {
         Normal,
         ConflictOurs,
@@ -110,11 +164,12 @@ inline std::vector<Conflict::Hunk> HunksFromConflictString(const ConflictMarkers
     std::vector<Conflict::Hunk> hunks;
     Conflict::Hunk hunk;
     _ParseState parseState = _ParseState::Normal;
-    for (const std::string& line : lines) {
+    _LinesForEach(str, [&] (std::string_view line) {
         switch (parseState) {
         case _ParseState::Normal:
             if (String::StartsWith(markers.start, line)) {
                 if (!hunk.empty()) hunks.push_back(std::move(hunk));
+                hunk = {};
                 parseState = _ParseState::ConflictOurs;
                 hunk.type = Conflict::Hunk::Type::Conflict;
             } else {
@@ -134,6 +189,7 @@ inline std::vector<Conflict::Hunk> HunksFromConflictString(const ConflictMarkers
         case _ParseState::ConflictTheirs:
             if (String::StartsWith(markers.end, line)) {
                 if (!hunk.empty()) hunks.push_back(std::move(hunk));
+                hunk = {};
                 parseState = _ParseState::Normal;
                 hunk.type = Conflict::Hunk::Type::Normal;
             } else {
@@ -144,57 +200,71 @@ inline std::vector<Conflict::Hunk> HunksFromConflictString(const ConflictMarkers
         default:
             abort(); // Invalid state
         }
-    }
+        return true;
+    });
     
     if (!hunk.empty()) hunks.push_back(std::move(hunk));
     return hunks;
 }
 
 inline std::string ConflictStringFromHunks(const ConflictMarkers& markers, const std::vector<Conflict::Hunk>& hunks) {
-    std::vector<std::string> lines;
-    for (const Git::Conflict::Hunk& hunk : hunks) {
-        switch (hunk.type) {
-        case Conflict::Hunk::Type::Normal:
-            lines.insert(lines.end(), hunk.normal.lines.begin(), hunk.normal.lines.end());
-            break;
+    // Emits every line of the result, in order
+    auto linesWrite = [&] (auto fn) {
+        for (const Git::Conflict::Hunk& hunk : hunks) {
+            switch (hunk.type) {
+            case Conflict::Hunk::Type::Normal:
+                for (std::string_view line : hunk.normal.lines) fn(line);
+                break;
         
-        case Conflict::Hunk::Type::Conflict:
-            lines.push_back(markers.start);
-            lines.insert(lines.end(), hunk.conflict.linesOurs.begin(), hunk.conflict.linesOurs.end());
-            lines.push_back(markers.separator);
-            lines.insert(lines.end(), hunk.conflict.linesTheirs.begin(), hunk.conflict.linesTheirs.end());
-            lines.push_back(markers.end);
-            break;
+            case Conflict::Hunk::Type::Conflict:
+                fn(markers.start);
+                for (std::string_view line : hunk.conflict.linesOurs) fn(line);
+                fn(markers.separator);
+                for (std::string_view line : hunk.conflict.linesTheirs) fn(line);
+                fn(markers.end);
+                break;
         
-        default:
-            abort();
+            default:
+                abort();
+            }
         }
-    }
-    return Toastbox::String::Join(lines, "\n");
+    };
+    
+    size_t len = 0;
+    linesWrite([&] (std::string_view line) { len += line.size()+1; });
+    
+    std::string r;
+    r.reserve(len);
+    bool first = true;
+    linesWrite([&] (std::string_view line) {
+        if (!first) r += '\n';
+        r += line;
+        first = false;
+    });
+    return r;
 }
 
 inline bool ConflictStringContainsConflictMarkers(const ConflictMarkers& markers, std::string_view str) {
-    const std::vector<std::string> lines = Toastbox::String::Split(str, "\n");
-    for (const std::string& line : lines) {
-        if (String::StartsWith(markers.start, line)     ||
+    bool r = false;
+    _LinesForEach(str, [&] (std::string_view line) {
+        r = String::StartsWith(markers.start, line)     ||
             String::StartsWith(markers.separator, line) ||
-            String::StartsWith(markers.end, line))
-            return true;
-    }
-    return false;
+            String::StartsWith(markers.end, line);
+        return !r;
+    });
+    return r;
 }
 
-inline std::vector<Conflict> ConflictsGet(const Repo& repo, const Index& index) {
-    using namespace Toastbox;
-    using _Path = std::filesystem::path;
-    
-    struct _IndexConflict {
-        const git_index_entry* ancestor = nullptr;
-        const git_index_entry* ours = nullptr;
-        const git_index_entry* theirs = nullptr;
-    };
+struct _IndexConflict {
+    std::filesystem::path path;
+    const git_index_entry* ancestor = nullptr;
+    const git_index_entry* ours = nullptr;
+    const git_index_entry* theirs = nullptr;
+};
     
-    std::map<_Path,_IndexConflict> conflicts;
+// _IndexConflictsGet(): returns the conflicted files in `index`, ordered by path
+inline std::vector<_IndexConflict> _IndexConflictsGet(const Index& index) {
+    std::map<std::filesystem::path,_IndexConflict> conflicts;
     
     for (size_t i=0;; i++) {
         const git_index_entry*const entry = index[i];
@@ -205,6 +275,7 @@ inline std::vector<Conflict> ConflictsGet(const Repo& repo, const Index& index)
         
         const git_index_stage_t stage = (git_index_stage_t)GIT_INDEX_ENTRY_STAGE(entry);
         _IndexConflict& conflict = conflicts[entry->path];
+        conflict.path = entry->path;
         
         if (stage == GIT_INDEX_STAGE_ANCESTOR) {
             assert(!conflict.ancestor);
@@ -220,132 +291,284 @@ inline std::vector<Conflict> ConflictsGet(const Repo& repo, const Index& index)
         }
     }
     
-    std::vector<Conflict> fileConflicts;
-    for (auto const& [path, conflict] : conflicts) {
-        constexpr uint32_t ObjTypeMask    = 0xF000;
-        constexpr uint32_t ObjTypeNone    = 0x0000;
-        constexpr uint32_t ObjTypeFile    = 0x8000;
-        constexpr uint32_t ObjTypeGitlink = 0xE000;
-        
-        const uint32_t objTypeOurs   = (conflict.ours ? (conflict.ours->mode & ObjTypeMask) : ObjTypeNone);
-        const uint32_t objTypeTheirs = (conflict.theirs ? (conflict.theirs->mode & ObjTypeMask) : ObjTypeNone);
+    std::vector<_IndexConflict> r;
+    for (auto& [path, conflict] : conflicts) r.push_back(std::move(conflict));
+    return r;
+}
         
-        Conflict fc = {
-            .path = path,
-        };
+// _ConflictGet(): extracts the Conflict for one conflicted file of `index`
+inline Conflict _ConflictGet(const Repo& repo, const Index& index, const _IndexConflict& conflict) {
+    constexpr uint32_t ObjTypeMask    = 0xF000;
+    constexpr uint32_t ObjTypeNone    = 0x0000;
+    constexpr uint32_t ObjTypeFile    = 0x8000;
+    constexpr uint32_t ObjTypeGitlink = 0xE000;
         
-        if (objTypeOurs==ObjTypeFile && objTypeTheirs==ObjTypeFile) {
-            // File vs file conflict
-            const Git::MergeFileResult mergeResult = repo.merge(conflict.ancestor, conflict.ours, conflict.theirs);
-            const std::string content(mergeResult->ptr, mergeResult->len);
-            fc.hunks = HunksFromConflictString({
-                .start      = Repo::MergeMarkerStart,
-                .separator  = Repo::MergeMarkerSeparator,
-                .end        = Repo::MergeMarkerEnd,
-            }, content);
+    const uint32_t objTypeOurs   = (conflict.ours ? (conflict.ours->mode & ObjTypeMask) : ObjTypeNone);
+    const uint32_t objTypeTheirs = (conflict.theirs ? (conflict.theirs->mode & ObjTypeMask) : ObjTypeNone);
+    
+    Conflict fc = {
+        .path = conflict.path,
+    };
+    
+    if (objTypeOurs==ObjTypeFile && objTypeTheirs==ObjTypeFile) {
+        // File vs file conflict
+        // Use the merge output that was retained when `index` was created, if any.
+        // Otherwise (eg the file's attributes specify another merge driver, or
+        // the conflict isn't due to the file's content) merge the file now.
+        Git::MergeFileResult mergeResult = index.mergeFile(conflict.ancestor, conflict.ours, conflict.theirs);
+        if (!mergeResult) mergeResult = repo.merge(conflict.ancestor, conflict.ours, conflict.theirs);
         
-        } else if (objTypeOurs==ObjTypeGitlink && objTypeTheirs==ObjTypeGitlink) {
-            // Submodule hash vs submodule hash conflict
-            fc.type = Conflict::Type::Submodule;
-            fc.hunks = {
-                Conflict::Hunk{
-                    .type = Conflict::Hunk::Type::Conflict,
-                    .conflict = {
-                        .linesOurs   = { StringFromId(conflict.ours->id) },
-                        .linesTheirs = { StringFromId(conflict.theirs->id) },
-                    },
-                },
-            };
+        fc.hunks = HunksFromConflictString({
+            .start      = Repo::MergeMarkerStart,
+            .separator  = Repo::MergeMarkerSeparator,
+            .end        = Repo::MergeMarkerEnd,
+        }, std::string_view(mergeResult->ptr, mergeResult->len));
+        fc.buffer = mergeResult;
+    
+    } else if (objTypeOurs==ObjTypeGitlink && objTypeTheirs==ObjTypeGitlink) {
+        // Submodule hash vs submodule hash conflict
+        const auto ids = std::make_shared<const std::array<std::string,2>>(std::array<std::string,2>{
+            StringFromId(conflict.ours->id),
+            StringFromId(conflict.theirs->id),
+        });
         
-        } else if ((objTypeOurs==ObjTypeFile && objTypeTheirs==ObjTypeNone) ||
-                   (objTypeOurs==ObjTypeNone && objTypeTheirs==ObjTypeFile)) {
-            // File vs no-file conflict
-            std::vector<std::string> linesOurs;
-            std::vector<std::string> linesTheirs;
-            
-            if (objTypeOurs==ObjTypeFile) {
-                Blob blob = repo.blobLookup(conflict.ours->id);
-                std::string content((const char*)blob.data(), blob.size());
-                linesOurs = Toastbox::String::Split(content, "\n");
-            }
-            
-            if (objTypeTheirs==ObjTypeFile) {
-                Blob blob = repo.blobLookup(conflict.theirs->id);
-                std::string content((const char*)blob.data(), blob.size());
-                linesTheirs = Toastbox::String::Split(content, "\n");
-            }
-            
-            fc.hunks.push_back({
+        fc.type = Conflict::Type::Submodule;
+        fc.hunks = {
+            Conflict::Hunk{
                 .type = Conflict::Hunk::Type::Conflict,
                 .conflict = {
-                    .linesOurs = linesOurs,
-                    .linesTheirs = linesTheirs,
+                    .linesOurs   = { (*ids)[0] },
+                    .linesTheirs = { (*ids)[1] },
                 },
-            });
+            },
+        };
+        fc.buffer = ids;
         
-        } else {
-            throw Toastbox::RuntimeError("unsupported conflict scenario");
-        }
+    } else if ((objTypeOurs==ObjTypeFile && objTypeTheirs==ObjTypeNone) ||
+               (objTypeOurs==ObjTypeNone && objTypeTheirs==ObjTypeFile)) {
+        // File vs no-file conflict
+        // Only one side exists, so its blob is the only buffer
+        const Blob blob = repo.blobLookup(objTypeOurs==ObjTypeFile ? conflict.ours->id : conflict.theirs->id);
+        std::vector<std::string_view> lines = LinesSplit(std::string_view((const char*)blob.data(), blob.size()));
         
-        fileConflicts.push_back(std::move(fc));
+        fc.hunks.push_back({
+            .type = Conflict::Hunk::Type::Conflict,
+        });
+        (objTypeOurs==ObjTypeFile ? fc.hunks.back().conflict.linesOurs : fc.hunks.back().conflict.linesTheirs) = std::move(lines);
+        fc.buffer = blob;
+    
+    } else {
+        throw Toastbox::RuntimeError("unsupported conflict scenario");
     }
     
-    return fileConflicts;
+    return fc;
 }
 
-// ConflictResolve(): resolve a conflict for a particular file, using the supplied file content `content`.
-// content == nullopt means that the file shouldn't exist.
-inline void ConflictResolve(const Repo& repo, const Index& index, const Conflict& conflict,
-    const std::optional<std::string>& content) {
+// ConflictStream: extracts the Conflicts of an index on a pool of worker threads, so
+// that the first conflict can be shown as soon as it's ready, while the rest are
+// extracted in the background.
+//
+// Each worker reads objects through its own handle to the repository's object
+// database (which is thread-safe, and includes the objects staged by an ObjectStage),
+// so the repository's objects must not be written until wait() returns. For the same
+// reason, `index` must not be modified until then.
+class ConflictStream {
+public:
+    ConflictStream(const Repo& repo, const Index& index) : _index(index), _conflicts(_IndexConflictsGet(index)) {
+        const Trace::Span trace("ConflictStream");
+        _s.results.resize(_conflicts.size());
+        _s.remaining = _conflicts.size();
+        
+        // Create the workers' handles up front, so that failing to create one doesn't
+        // leave the workers that were already started running
+        const size_t threadCount = std::min((size_t)std::max(1u, std::thread::hardware_concurrency()), _conflicts.size());
+        std::vector<Repo> repos;
+        for (size_t i=0; i<threadCount; i++) repos.push_back(repo.odbShare());
+        
+        try {
+            for (const Repo& r : repos) {
+                _threads.emplace_back([this, r] { _threadRun(r); });
+            }
+        
+        } catch (...) {
+            // Our destructor doesn't run if we throw, so stop the workers here
+            {
+                auto lock = std::unique_lock(_s.lock);
+                _s.stop = true;
+            }
+            wait();
+            throw;
+        }
+    }
     
-    const char* path = conflict.path.c_str();
-    const git_index_entry* entryPrev = index.find(conflict.path, GIT_INDEX_STAGE_THEIRS);
-    if (!entryPrev) entryPrev = index.find(conflict.path, GIT_INDEX_STAGE_OURS);
-    assert(entryPrev);
+    ~ConflictStream() {
+        {
+            auto lock = std::unique_lock(_s.lock);
+            _s.stop = true;
+        }
+        wait();
+    }
     
-    switch (conflict.type) {
-    case Conflict::Type::File: {
-        if (content) {
-            const Blob blob = repo.blobCreate(content->data(), content->size());
+    ConflictStream(const ConflictStream&) = delete;
+    ConflictStream& operator=(const ConflictStream&) = delete;
+    
+    // size(): the number of conflicted files
+    size_t size() const { return _conflicts.size(); }
+    
+    // done(): whether every conflict has been extracted
+    bool done() {
+        auto lock = std::unique_lock(_s.lock);
+        return !_s.remaining;
+    }
+    
+    // get(): returns the conflict at `idx`, waiting until it's extracted
+    // Throws if extracting it failed.
+    const Conflict& get(size_t idx) {
+        assert(idx < size());
+        auto lock = std::unique_lock(_s.lock);
+        _Result& result = _s.results[idx];
+        _s.signal.wait(lock, [&] { return result.done; });
+        if (result.err) std::rethrow_exception(result.err);
+        return result.conflict;
+    }
+    
+    // wait(): waits until every conflict has been extracted, and the workers are done
+    // with the object database
+    void wait() {
+        for (std::thread& thread : _threads) thread.join();
+        _threads.clear();
+    }
+    
+    // all(): returns every conflict, waiting until they're all extracted
+    // Throws if extracting any of them failed.
+    std::vector<Conflict> all() {
+        wait();
+        std::vector<Conflict> r;
+        for (size_t i=0; i<size(); i++) r.push_back(get(i));
+        return r;
+    }
+    
+private:
+    struct _Result {
+        Conflict conflict;
+        std::exception_ptr err;
+        bool done = false;
+    };
+    
+    void _threadRun(const Repo& repo) {
+        Trace::ThreadName("conflict extract");
+        for (;;) {
+            size_t idx = 0;
+            {
+                auto lock = std::unique_lock(_s.lock);
+                if (_s.stop || _s.next>=_conflicts.size()) return;
+                idx = _s.next++;
+            }
             
-            const git_index_entry entry = {
-                .mode = entryPrev->mode,
-                .file_size = (uint32_t)content->size(),
-                .id = blob.id(),
-                .path = path,
-            };
+            _Result result = { .done = true };
+            try {
+                result.conflict = _ConflictGet(repo, _index, _conflicts[idx]);
+            } catch (...) {
+                result.err = std::current_exception();
+            }
             
-            index.add(entry);
-        
-        } else {
-            index.remove(path);
+            {
+                auto lock = std::unique_lock(_s.lock);
+                _s.results[idx] = std::move(result);
+                _s.remaining--;
+            }
+            _s.signal.notify_all();
         }
-        break;
     }
     
-    case Conflict::Type::Submodule: {
-        if (!content) throw Toastbox::RuntimeError("unsupported conflict scenario");
-        
+    const Index _index;
+    const std::vector<_IndexConflict> _conflicts;
+    std::vector<std::thread> _threads;
+    
+    // Shared between threads; protected by `lock`
+    struct {
+        std::mutex lock;
+        std::condition_variable signal;
+        std::vector<_Result> results;
+        size_t next = 0;
+        size_t remaining = 0;
+        bool stop = false;
+    } _s;
+};
+
+// ConflictsGet(): returns the Conflicts of `index`
+inline std::vector<Conflict> ConflictsGet(const Repo& repo, const Index& index) {
+    const Trace::Span trace("ConflictsGet");
+    return ConflictStream(repo, index).all();
+}
+
+// _ConflictResolve(): resolves a conflict for a particular file, using the object `id`
+// (a blob for files, a commit for submodules). id == nullopt means that the file
+// shouldn't exist.
+inline void _ConflictResolve(const Index& index, const Conflict& conflict, const std::optional<Id>& id, size_t size) {
+    const char* path = conflict.path.c_str();
+    const git_index_entry* entryPrev = index.find(conflict.path, GIT_INDEX_STAGE_THEIRS);
+    if (!entryPrev) entryPrev = index.find(conflict.path, GIT_INDEX_STAGE_OURS);
+    assert(entryPrev);
+    
+    if (id) {
         const git_index_entry entry = {
             .mode = entryPrev->mode,
-            .id = IdFromString(*content),
+            .file_size = (uint32_t)size,
+            .id = *id,
             .path = path,
         };
         index.add(entry);
-        break;
+    
+    } else {
+        if (conflict.type == Conflict::Type::Submodule) throw Toastbox::RuntimeError("unsupported conflict scenario");
+        index.remove(path);
     }
     
+    index.conflictClear(path);
+}
+
+// ConflictResolve(): resolve a conflict for a particular file, using the supplied file content `content`.
+// content == nullopt means that the file shouldn't exist.
+inline void ConflictResolve(const Repo& repo, const Index& index, const Conflict& conflict,
+    const std::optional<std::string>& content) {
+    
+    switch (conflict.type) {
+    case Conflict::Type::File:
+        if (content) _ConflictResolve(index, conflict, repo.blobCreate(content->data(), content->size()).id(), content->size());
+        else         _ConflictResolve(index, conflict, std::nullopt, 0);
+        break;
+    case Conflict::Type::Submodule:
+        _ConflictResolve(index, conflict, (content ? std::optional<Id>(IdFromString(*content)) : std::nullopt), 0);
+        break;
     default:
         throw Toastbox::RuntimeError("unsupported conflict type");
     }
+}
     
-    index.conflictClear(path);
+// ConflictResolve(): resolve a conflict for a particular file, by choosing `side` for
+// every hunk. The content is written straight from the hunks into the buffer that the
+// blob is created from.
+inline void ConflictResolve(const Repo& repo, const Index& index, const Conflict& conflict, Conflict::Side side) {
+    if (conflict.noFile(side)) {
+        _ConflictResolve(index, conflict, std::nullopt, 0);
+        return;
+    }
     
-//    ir = git_index_write(*index);
-//    if (ir) throw Error(ir, "git_index_write failed");
+    std::string content;
+    content.reserve(conflict.contentSize(side));
+    conflict.contentWrite(side, [&] (std::string_view x) { content += x; });
     
-//    int ir = git_index_add_from_buffer(*index, conflict.entry, content.data(), content.size());
-//    if (ir) throw Error(ir, "git_index_add_from_buffer failed");
+    switch (conflict.type) {
+    case Conflict::Type::File:
+        _ConflictResolve(index, conflict, repo.blobCreate(content.data(), content.size()).id(), content.size());
+        break;
+    case Conflict::Type::Submodule:
+        _ConflictResolve(index, conflict, IdFromString(content), 0);
+        break;
+    default:
+        throw Toastbox::RuntimeError("unsupported conflict type");
+    }
 }
 
 } // namespace Git
@@ -0,0 +1,133 @@
+#pragma once
+#include <mutex>
+#include <list>
+#include <unordered_map>
+#include "Git.h"
+#include "IdSet.h"
+
+namespace Git {
+
+// FirstParentIndex: maps the commits along the first-parent chain of `head` to their
+// depth, where `head` has depth 0.
+//
+// The index is extended lazily, only as deep as the deepest commit that's been
+// queried, so queries near the top of a long history stay cheap. Because a commit's
+// first-parent chain never changes, the underlying index is cached by the head's id
+// and shared between FirstParentIndex instances; when a ref moves, its new head
+// simply gets a new index.
+class FirstParentIndex {
+public:
+    FirstParentIndex(const Commit& head) : _head(head), _state(_StateGet(head.id())) {
+        assert(head);
+    }
+    
+    // depth(): returns the depth of `id` below `head`, or std::nullopt if `id` isn't
+    // in the first-parent chain of `head`
+    std::optional<size_t> depth(const Id& id) const {
+        auto lock = std::unique_lock(_state->lock);
+        for (;;) {
+            auto find = _state->depths.find(id);
+            if (find != _state->depths.end()) return find->second;
+            if (!_extend()) return std::nullopt;
+        }
+    }
+    
+    std::optional<size_t> depth(const Commit& commit) const {
+        if (!commit) return std::nullopt;
+        return depth(commit.id());
+    }
+    
+    // at(): returns the commit `depth` first-parents below `head`, or nullptr if the
+    // history isn't that deep
+    Commit at(size_t depth) const {
+        Id id;
+        {
+            auto lock = std::unique_lock(_state->lock);
+            while (_state->ids.size() <= depth) {
+                if (!_extend()) return nullptr;
+            }
+            id = _state->ids[depth];
+        }
+        
+        return _lookup(id);
+    }
+    
+    // sorted(): returns `ids` as commits, ordered from earliest to latest
+    // All of `ids` must be in the first-parent chain of `head`
+    std::vector<Commit> sorted(const IdSet& ids) const {
+        std::vector<std::pair<size_t,Id>> x;
+        for (const Id& id : ids) {
+            const std::optional<size_t> d = depth(id);
+            assert(d);
+            x.emplace_back(*d, id);
+        }
+        std::sort(x.begin(), x.end(), [] (const auto& a, const auto& b) { return a.first > b.first; });
+        
+        std::vector<Commit> r;
+        for (const auto& [_, id] : x) r.push_back(_lookup(id));
+        return r;
+    }
+    
+private:
+    // _State: the shared index, which only holds ids so that it never outlives
+    // any libgit2 objects
+    struct _State {
+        _State(const Id& head) : head(head), next(head) {}
+        const Id head;
+        std::mutex lock;
+        std::vector<Id> ids;
+        std::unordered_map<Id,size_t,IdHash,IdEqual> depths;
+        Id next; // Next commit to index
+        bool done = false; // Whether we've indexed the root commit
+    };
+    
+    using _StatePtr = std::shared_ptr<_State>;
+    
+    static constexpr size_t _CacheCap = 64;
+    
+    static _StatePtr _StateGet(const Id& head) {
+        static std::mutex Lock;
+        static std::list<_StatePtr> Cache; // Most recently used first
+        
+        auto lock = std::unique_lock(Lock);
+        for (auto it=Cache.begin(); it!=Cache.end(); it++) {
+            if (git_oid_equal(&(*it)->head, &head)) {
+                Cache.splice(Cache.begin(), Cache, it);
+                return Cache.front();
+            }
+        }
+        
+        Cache.push_front(std::make_shared<_State>(head));
+        if (Cache.size() > _CacheCap) Cache.pop_back();
+        return Cache.front();
+    }
+    
+    Commit _lookup(const Id& id) const {
+        git_commit* x = nullptr;
+        int ir = git_commit_lookup(&x, git_commit_owner(*_head), &id);
+        if (ir) throw Error(ir, "git_commit_lookup failed");
+        return x;
+    }
+    
+    // _extend(): indexes the next commit in the chain; returns false if there
+    // are no more commits to index
+    // _state->lock must be held
+    bool _extend() const {
+        if (_state->done) return false;
+        
+        const Commit commit = _lookup(_state->next);
+        
+        _state->depths.emplace(_state->next, _state->ids.size());
+        _state->ids.push_back(_state->next);
+        
+        const Id* parentId = git_commit_parent_id(*commit, 0);
+        if (parentId) _state->next = *parentId;
+        else          _state->done = true;
+        return true;
+    }
+    
+    Commit _head;
+    _StatePtr _state;
+};
+
+} // namespace Git
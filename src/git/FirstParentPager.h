@@ -0,0 +1,109 @@
+#pragma once
+#include <array>
+#include "Git.h"
+
+namespace Git {
+
+// FirstParentPager: random access to the commits along the first-parent chain of
+// `head`, by depth (where `head` has depth 0), using bounded memory.
+//
+// Unlike FirstParentIndex, which remembers every commit that it's indexed, the pager
+// only keeps the ids of the _PageCount most recently used pages, plus one anchor id
+// per page of history seen so far. This makes it suitable for browsing arbitrarily
+// long histories: stepping through a 100k-commit chain keeps ~400 anchors around,
+// and revisiting an evicted page costs one walk of _PageSize commits from its anchor.
+class FirstParentPager {
+public:
+    FirstParentPager() {}
+    FirstParentPager(const Commit& head) : _head(head) {
+        assert(head);
+        _anchors.push_back(head.id());
+    }
+    
+    operator bool() const { return (bool)_head; }
+    
+    const Commit& head() const { return _head; }
+    
+    // at(): returns the commit `depth` first-parents below `head`, or nullptr if the
+    // history isn't that deep
+    Commit at(size_t depth) {
+        if (!_head) return nullptr;
+        const _Page* page = _pageGet(depth/_PageSize);
+        if (!page) return nullptr;
+        const size_t off = depth%_PageSize;
+        if (off >= page->ids.size()) return nullptr;
+        return _lookup(page->ids[off]);
+    }
+    
+private:
+    static constexpr size_t _PageSize = 256;
+    // Two pages so that a viewport straddling a page boundary doesn't thrash
+    static constexpr size_t _PageCount = 2;
+    
+    struct _Page {
+        size_t idx = 0;
+        std::vector<Id> ids; // Empty if the slot is unused
+        uint64_t used = 0;
+    };
+    
+    Commit _lookup(const Id& id) const {
+        git_commit* x = nullptr;
+        int ir = git_commit_lookup(&x, git_commit_owner(*_head), &id);
+        if (ir) throw Error(ir, "git_commit_lookup failed");
+        return x;
+    }
+    
+    const _Page* _pageGet(size_t idx) {
+        for (_Page& page : _pages) {
+            if (!page.ids.empty() && page.idx==idx) {
+                page.used = ++_useCounter;
+                return &page;
+            }
+        }
+        
+        // Walk forward one page at a time until we know where page `idx` starts
+        while (_anchors.size() <= idx) {
+            if (_done) return nullptr;
+            _pageLoad(_anchors.size()-1);
+        }
+        return &_pageLoad(idx);
+    }
+    
+    // _pageLoad(): walks the commits of page `idx` (whose anchor must be known) into
+    // the least recently used slot, recording the next page's anchor along the way
+    _Page& _pageLoad(size_t idx) {
+        assert(idx < _anchors.size());
+        _Page& page = *std::min_element(_pages.begin(), _pages.end(),
+            [] (const _Page& a, const _Page& b) { return a.used < b.used; });
+        
+        page.idx = idx;
+        page.ids.clear();
+        page.used = ++_useCounter;
+        
+        Id id = _anchors[idx];
+        for (;;) {
+            page.ids.push_back(id);
+            const Commit commit = _lookup(id);
+            const Id* parentId = git_commit_parent_id(*commit, 0);
+            if (!parentId) {
+                _done = true;
+                break;
+            }
+            
+            id = *parentId;
+            if (page.ids.size() == _PageSize) {
+                if (_anchors.size() == idx+1) _anchors.push_back(id);
+                break;
+            }
+        }
+        return page;
+    }
+    
+    Commit _head;
+    std::vector<Id> _anchors; // _anchors[i] is the id of the commit at depth i*_PageSize
+    std::array<_Page,_PageCount> _pages;
+    uint64_t _useCounter = 0;
+    bool _done = false; // Whether we've walked to the root commit
+};
+
+} // namespace Git
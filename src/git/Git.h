@@ -2,14 +2,22 @@
 #include <filesystem>
 #include <optional>
 #include <vector>
+#include <map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <cassert>
 #include <cstring>
 #include "Debase.h"
 #include "RefCounted.h"
+#include "Trace.h"
 #include "lib/toastbox/RuntimeError.h"
 #include "lib/toastbox/Defer.h"
 #include "lib/toastbox/String.h"
 #include "lib/libgit2/include/git2.h"
+#include "lib/libgit2/include/git2/sys/repository.h"
+#include "lib/libgit2/include/git2/sys/merge.h"
 
 namespace Git {
 using namespace Toastbox;
@@ -58,6 +66,20 @@ public:
 
 using Id = git_oid;
 
+// IdHash/IdEqual: for keying hash tables by Id
+struct IdHash {
+    size_t operator()(const Id& id) const {
+        // Object ids are already uniformly distributed
+        size_t x = 0;
+        memcpy(&x, id.id, sizeof(x));
+        return x;
+    }
+};
+
+struct IdEqual {
+    bool operator()(const Id& a, const Id& b) const { return git_oid_equal(&a, &b); }
+};
+
 inline std::string StringFromId(const git_oid& oid) {
     return git_oid_tostr_s(&oid);
 }
@@ -174,18 +196,53 @@ inline Time TimeFromString(const std::string& str) {
 }
 
 using Tree = RefCounted<git_tree*, git_tree_free>;
+using Odb = RefCounted<git_odb*, git_odb_free>;
+using PackBuilder = RefCounted<git_packbuilder*, git_packbuilder_free>;
 
-static void _MergeFileResultFree(git_merge_file_result& x) {
+inline void _MergeFileResultFree(git_merge_file_result& x) {
     git_merge_file_result_free(&x);
 }
 
 using MergeFileResult = RefCounted<git_merge_file_result, _MergeFileResultFree>;
 
+// MergeFile: the output of merging the content of a conflicted file, identified by
+// the blobs that were merged (ancestor is zero if the file has no ancestor)
+struct MergeFile {
+    Id ancestor = {};
+    Id ours = {};
+    Id theirs = {};
+    MergeFileResult result;
+};
+
+using MergeFiles = std::map<std::filesystem::path,MergeFile>;
+
 struct Index : RefCounted<git_index*, git_index_free> {
     using RefCounted::RefCounted;
     
     bool conflicts() const { return git_index_has_conflicts(*get()); }
     
+    // mergeFile(): returns the merge output that was retained when this index was
+    // created by a merge, for the file conflict described by the given entries, or
+    // nullptr if the merge didn't produce any
+    MergeFileResult mergeFile(
+        const git_index_entry* ancestor,
+        const git_index_entry* ours,
+        const git_index_entry* theirs
+    ) const {
+        if (!mergeFiles || !ours || !theirs) return nullptr;
+        const auto it = mergeFiles->find(ours->path);
+        if (it == mergeFiles->end()) return nullptr;
+        const MergeFile& mf = it->second;
+        const Id zero = {};
+        if (!git_oid_equal(&mf.ancestor, (ancestor ? &ancestor->id : &zero)) ||
+            !git_oid_equal(&mf.ours, &ours->id) ||
+            !git_oid_equal(&mf.theirs, &theirs->id)) return nullptr;
+        return mf.result;
+    }
+    
+    // Merge output of the conflicted files, when the index was created by a merge
+    std::shared_ptr<const MergeFiles> mergeFiles;
+    
     const git_index_entry* operator [](size_t i) const {
         return git_index_get_byindex(*get(), i);
     }
@@ -297,6 +354,10 @@ struct Commit : Object {
         return x;
     }
     
+    const Id& treeId() const {
+        return *git_commit_tree_id(*get());
+    }
+    
     Commit parent(size_t n=0) const {
         git_commit* x = nullptr;
         int ir = git_commit_parent(&x, *get(), (unsigned int)n);
@@ -649,7 +710,9 @@ public:
         
         // We succeeded -- don't call shutdown!
         shutdown = false;
-        return x;
+        Repo repo = x;
+        repo._traceAttach();
+        return repo;
     }
     
     static Repo Open(const Submodule& sm) {
@@ -666,6 +729,43 @@ public:
         return x;
     }
     
+    // reopen(): returns a new handle to the same repository
+    // Repository handles can't be used from multiple threads simultaneously, so
+    // each thread that accesses the repository needs its own handle.
+    Repo reopen() const {
+        bool shutdown = true;
+        git_libgit2_init();
+        Defer( if (shutdown) git_libgit2_shutdown() );
+        
+        git_repository* x = nullptr;
+        int ir = git_repository_open(&x, git_repository_path(*get()));
+        if (ir) throw Error(ir, "git_repository_open failed");
+        
+        // We succeeded -- don't call shutdown!
+        shutdown = false;
+        Repo repo = x;
+        repo._traceAttach();
+        return repo;
+    }
+    
+    // odbShare(): returns a new handle that shares our object database, and so sees the
+    // same objects, including any that are staged in memory (see ObjectStage)
+    // The object database is thread-safe, so the handle can read objects on another
+    // thread. It has no working directory, so it's only useful for reading objects.
+    Repo odbShare() const {
+        bool shutdown = true;
+        git_libgit2_init();
+        Defer( if (shutdown) git_libgit2_shutdown() );
+        
+        git_repository* x = nullptr;
+        int ir = git_repository_wrap_odb(&x, *odb());
+        if (ir) throw Error(ir, "git_repository_wrap_odb failed");
+        
+        // We succeeded -- don't call shutdown!
+        shutdown = false;
+        return x;
+    }
+    
     std::filesystem::path path() const {
         return git_repository_workdir(*get());
     }
@@ -705,56 +805,83 @@ public:
     }
     
     void checkout(const Rev& rev) const {
+        git_checkout_options opts = GIT_CHECKOUT_OPTIONS_INIT;
+        _checkoutTree(rev.commit.tree(), opts);
+        _headSet(rev);
+        submodulesUpdate(true);
+    }
+    
+    // checkout(): checks out `rev`, assuming that the index and working tree match
+    // `treePrev`, so that only the paths that differ between `treePrev` and the
+    // rev's tree need to be updated. Skips updating the working tree entirely if
+    // the trees are identical, and only updates the submodules whose commit changed.
+    void checkout(const Rev& rev, const Tree& treePrev) const {
+        const Trace::Span trace("Repo::checkout");
+        const Tree tree = rev.commit.tree();
+        
         struct Ctx {
-            std::vector<std::filesystem::path> conflicts;
+            std::vector<std::string> paths;
+            std::vector<std::string> submodulePaths;
         };
         Ctx ctx;
         
-        git_checkout_options opts = GIT_CHECKOUT_OPTIONS_INIT;
-        opts.notify_flags |= GIT_CHECKOUT_NOTIFY_CONFLICT;
-        opts.notify_payload = &ctx;
-        opts.notify_cb = [] (
-            git_checkout_notify_t why,
-            const char* path,
-            const git_diff_file* baseline,
-            const git_diff_file* target,
-            const git_diff_file* workdir,
-            void* ctxp
-        ) -> int {
-            Ctx& ctx = *(Ctx*)ctxp;
-            if (why == GIT_CHECKOUT_NOTIFY_CONFLICT) {
-                ctx.conflicts.push_back(workdir->path);
+        if (!git_oid_equal(git_tree_id(*tree), git_tree_id(*treePrev))) {
+            git_diff* diff = nullptr;
+            git_diff_options diffOpts = GIT_DIFF_OPTIONS_INIT;
+            int ir = git_diff_tree_to_tree(&diff, *get(), *treePrev, *tree, &diffOpts);
+            if (ir) throw Error(ir, "git_diff_tree_to_tree failed");
+            Defer(git_diff_free(diff));
+            
+            for (size_t i=0; i<git_diff_num_deltas(diff); i++) {
+                const git_diff_delta* delta = git_diff_get_delta(diff, i);
+                ctx.paths.push_back(delta->old_file.path);
+                if (strcmp(delta->old_file.path, delta->new_file.path)) {
+                    ctx.paths.push_back(delta->new_file.path);
+                }
+                
+                if (delta->new_file.mode == GIT_FILEMODE_COMMIT) {
+                    ctx.submodulePaths.push_back(delta->new_file.path);
+                }
             }
-            return 0;
-        };
+        }
         
-        int ir = git_checkout_tree(*get(), (git_object*)*rev.commit.tree(), &opts);
-        if (ir == GIT_ECONFLICT) throw ConflictError(ir, ctx.conflicts);
-        else if (ir)             throw Error(ir, "git_checkout_tree failed");
+        if (!ctx.paths.empty()) {
+            std::vector<char*> paths;
+            for (std::string& path : ctx.paths) paths.push_back(path.data());
+            
+            git_checkout_options opts = GIT_CHECKOUT_OPTIONS_INIT;
+            opts.baseline = *treePrev;
+            opts.checkout_strategy |= GIT_CHECKOUT_DISABLE_PATHSPEC_MATCH;
+            opts.paths = { .strings = paths.data(), .count = paths.size() };
+            _checkoutTree(tree, opts);
+        }
         
-        if (rev.ref) {
-            const std::string fullName = rev.ref.fullName();
-            ir = git_repository_set_head(*get(), fullName.c_str());
-            if (ir) throw Error(ir, "git_repository_set_head failed");
+        _headSet(rev);
         
-        } else {
-            ir = git_repository_set_head_detached(*get(), &rev.commit.id());
-            if (ir) throw Error(ir, "git_repository_set_head_detached failed");
+        std::deque<_SubmoduleUpdate> updates;
+        for (const std::string& p : ctx.submodulePaths) {
+            updates.push_back({path(), p});
         }
-        
-        submodulesUpdate(true);
+        _SubmodulesUpdate(std::move(updates), true);
     }
     
-    
     void headDetach() const {
         int ir = git_repository_detach_head(*get());
         if (ir) throw Error(ir, "git_repository_detach_head failed");
     }
     
     void headAttach(const Rev& rev) const {
+        const Trace::Span trace("Repo::headAttach");
         checkout(rev);
     }
     
+    // headAttach(): attaches HEAD to `rev`, assuming that the index and working tree
+    // match `treePrev`; see checkout()
+    void headAttach(const Rev& rev, const Tree& treePrev) const {
+        const Trace::Span trace("Repo::headAttach");
+        checkout(rev, treePrev);
+    }
+    
 //    void headDetach() const {
 //        int ir = git_repository_head_detached(*get());
 //        if (ir < 0) throw Error(ir, "git_repository_head_detached failed");
@@ -831,35 +958,43 @@ public:
 //    }
     
     Index treesMerge(git_merge_file_favor_t fileFavor, const Tree& ancestorTree, const Tree& dstTree, const Tree& srcTree) const {
+        const Trace::Span trace("Repo::treesMerge");
         git_merge_options opts = GIT_MERGE_OPTIONS_INIT;
         opts.file_favor = fileFavor;
         
-        git_index* x = nullptr;
-        int ir = git_merge_trees(
-            &x,
-            *get(),
-            (ancestorTree ? *ancestorTree : nullptr),
-            (dstTree ? *dstTree : nullptr),
-            (srcTree ? *srcTree : nullptr),
-            &opts
-        );
-        if (ir) throw Error(ir, "git_merge_trees failed");
-        return x;
+        return _MergeFilesRetain(opts, [&] {
+            git_index* x = nullptr;
+            int ir = git_merge_trees(
+                &x,
+                *get(),
+                (ancestorTree ? *ancestorTree : nullptr),
+                (dstTree ? *dstTree : nullptr),
+                (srcTree ? *srcTree : nullptr),
+                &opts
+            );
+            if (ir) throw Error(ir, "git_merge_trees failed");
+            return x;
+        });
     }
     
     Tree indexWrite(const Index& index) const {
+        const Trace::Span trace("Repo::indexWrite");
         Id treeId;
         int ir = git_index_write_tree_to(&treeId, *index, *get());
         if (ir) throw Error(ir, "git_index_write_tree_to failed");
+        return treeLookup(treeId);
+    }
         
+    Tree treeLookup(const Id& id) const {
         git_tree* x = nullptr;
-        ir = git_tree_lookup(&x, *get(), &treeId);
+        int ir = git_tree_lookup(&x, *get(), &id);
         if (ir) throw Error(ir, "git_tree_lookup failed");
         return x;
     }
     
     // commitParentSet(): commit.parent[0] = parent
     Index commitParentSet(git_merge_file_favor_t fileFavor, const Commit& commit, const Commit& parent) const {
+        const Trace::Span trace("Repo::commitParentSet");
         assert(commit);
         
         if (parent) {
@@ -867,10 +1002,12 @@ public:
             opts.file_favor = fileFavor;
             
             const unsigned int mainline = (commit.isMerge() ? 1 : 0);
-            git_index* x = nullptr;
-            int ir = git_cherrypick_commit(&x, *get(), (git_commit*)*commit, (git_commit*)*parent, mainline, &opts);
-            if (ir) throw Error(ir, "git_cherrypick_commit failed");
-            return x;
+            return _MergeFilesRetain(opts, [&] {
+                git_index* x = nullptr;
+                int ir = git_cherrypick_commit(&x, *get(), (git_commit*)*commit, (git_commit*)*parent, mainline, &opts);
+                if (ir) throw Error(ir, "git_cherrypick_commit failed");
+                return x;
+            });
         
         } else {
             Commit oldParent = commit.parent();
@@ -880,9 +1017,12 @@ public:
     }
     
     Commit commitParentSetFinish(const Index& index, const Commit& commit, const Commit& parent) const {
+        return commitParentSetFinish(indexWrite(index), commit, parent);
+    }
+    
+    Commit commitParentSetFinish(const Tree& tree, const Commit& commit, const Commit& parent) const {
         assert(commit);
         
-        Tree tree = indexWrite(index);
         std::vector<Commit> parents = commit.parents();
         if (!parents.empty()) parents.erase(parents.begin());
         if (parent) parents.insert(parents.begin(), parent);
@@ -913,6 +1053,28 @@ public:
         return commitLookup(id);
     }
     
+    // commitsIntegrate: combines `commits`, where each commit is the parent of the
+    // next, into a single commit
+    // Unlike repeated commitIntegrate() calls this doesn't require any merges, since
+    // the result's content is simply that of the last commit. The result is otherwise
+    // identical, by keeping the first commit's parents/author and combining the
+    // commit messages in the same way.
+    Commit commitsIntegrate(const std::vector<Commit>& commits) const {
+        assert(!commits.empty());
+        const Commit& first = commits.front();
+        
+        std::stringstream msg;
+        for (const Commit& commit : commits) {
+            if (commit != first) msg << "\n";
+            msg << git_commit_message(*commit);
+        }
+        
+        Id id;
+        int ir = git_commit_amend(&id, *first, nullptr, nullptr, nullptr, git_commit_message_encoding(*first), msg.str().c_str(), *commits.back().tree());
+        if (ir) throw Error(ir, "git_commit_amend failed");
+        return commitLookup(id);
+    }
+    
     // commitAmend(): change parents/tree of a commit
     Commit commitAmend(const Commit& commit, const std::vector<Commit>& parents, const Tree& tree) const {
         Id id;
@@ -963,6 +1125,7 @@ public:
 //    }
     
     Ref refReplace(const Ref& ref, const Commit& commit) const {
+        const Trace::Span trace("Repo::refReplace");
         if (ref.isLocalBranch()) {
             return branchReplace(Branch::ForRef(ref), commit);
         
@@ -1134,6 +1297,43 @@ public:
         return tagLookup(name);
     }
     
+    std::filesystem::path objectsPath() const {
+        Buf buf;
+        {
+            git_buf x = GIT_BUF_INIT;
+            int ir = git_repository_item_path(&x, *get(), GIT_REPOSITORY_ITEM_OBJECTS);
+            if (ir) throw Error(ir, "git_repository_item_path failed");
+            buf = x;
+        }
+        return buf->ptr;
+    }
+    
+    // objectExists(): returns whether the object database has `id`
+    // Doesn't rescan the object directories if it's missing, so objects written by
+    // another process since the last scan aren't found.
+    bool objectExists(const Id& id) const {
+        return git_odb_exists_ext(*odb(), &id, GIT_ODB_LOOKUP_NO_REFRESH);
+    }
+    
+    Odb odb() const {
+        git_odb* x = nullptr;
+        int ir = git_repository_odb(&x, *get());
+        if (ir) throw Error(ir, "git_repository_odb failed");
+        return x;
+    }
+    
+    void odbSet(const Odb& odb) const {
+        int ir = git_repository_set_odb(*get(), *odb);
+        if (ir) throw Error(ir, "git_repository_set_odb failed");
+    }
+    
+    PackBuilder packBuilderCreate() const {
+        git_packbuilder* x = nullptr;
+        int ir = git_packbuilder_new(&x, *get());
+        if (ir) throw Error(ir, "git_packbuilder_new failed");
+        return x;
+    }
+    
     Config config() const {
         git_config* x = nullptr;
         int ir = git_repository_config(&x, *get());
@@ -1151,26 +1351,57 @@ public:
         return x;
     }
     
+    // dirty(): returns whether the index or working tree has modifications relative to
+    // HEAD, ignoring untracked files and files that were added to the index
+    //
+    // Unlike status(), this never enumerates untracked files, and it stops at the first
+    // modification. Comparing the working tree to the index trusts the index's stat
+    // cache, so only files whose stat info changed are hashed.
     bool dirty() const {
-        StatusList s = status();
-        for (size_t i=0;; i++) {
-            const git_status_entry* e = s[i];
-            if (!e) break;
+        const Trace::Span trace("Repo::dirty");
             
-            constexpr int Dirty =
-                GIT_STATUS_INDEX_MODIFIED   |
-                GIT_STATUS_INDEX_DELETED    |
-                GIT_STATUS_INDEX_RENAMED    |
-                GIT_STATUS_INDEX_TYPECHANGE |
-                GIT_STATUS_WT_MODIFIED      |
-                GIT_STATUS_WT_DELETED       |
-                GIT_STATUS_WT_RENAMED       |
-                GIT_STATUS_WT_TYPECHANGE    ;
-            
-            if (Dirty & e->status) {
-                return true;
+        // Abort the diff as soon as it finds a modification
+        constexpr int Dirty = GIT_EUSER;
+        git_diff_options opts = GIT_DIFF_OPTIONS_INIT;
+        opts.flags = GIT_DIFF_SKIP_BINARY_CHECK;
+        opts.notify_cb = [] (const git_diff*, const git_diff_delta* delta, const char*, void*) -> int {
+            switch (delta->status) {
+            case GIT_DELTA_MODIFIED:
+            case GIT_DELTA_DELETED:
+            case GIT_DELTA_RENAMED:
+            case GIT_DELTA_TYPECHANGE:
+                return Dirty;
+            default:
+                // Skip the delta; we only care whether one exists
+                return 1;
             }
-        }
+        };
+            
+        // Get HEAD's tree; an unborn HEAD has no tree
+        git_object* tree = nullptr;
+        int ir = git_revparse_single(&tree, *get(), "HEAD^{tree}");
+        if (ir && ir!=GIT_ENOTFOUND && ir!=GIT_EUNBORNBRANCH) throw Error(ir, "git_revparse_single failed");
+        Defer(git_object_free(tree));
+        
+        git_index* index = nullptr;
+        ir = git_repository_index(&index, *get());
+        if (ir) throw Error(ir, "git_repository_index failed");
+        Defer(git_index_free(index));
+        
+        // HEAD -> index
+        git_diff* diff = nullptr;
+        ir = git_diff_tree_to_index(&diff, *get(), (git_tree*)tree, index, &opts);
+        git_diff_free(diff);
+        if (ir == Dirty) return true;
+        if (ir) throw Error(ir, "git_diff_tree_to_index failed");
+        
+        // Index -> working tree
+        diff = nullptr;
+        ir = git_diff_index_to_workdir(&diff, *get(), index, &opts);
+        git_diff_free(diff);
+        if (ir == Dirty) return true;
+        if (ir) throw Error(ir, "git_diff_index_to_workdir failed");
+        
         return false;
     }
     
@@ -1214,15 +1445,20 @@ public:
         return ctx.submodules;
     }
     
+    Submodule submoduleLookup(const std::filesystem::path& path) const {
+        git_submodule* x = nullptr;
+        int ir = git_submodule_lookup(&x, *get(), path.c_str());
+        if (ir) throw Error(ir, "git_submodule_lookup failed");
+        return x;
+    }
+    
+    // submodulesUpdate(): updates our submodules concurrently; see _SubmodulesUpdate()
     void submodulesUpdate(bool recurse=false) const {
-        std::vector<Submodule> sms = submodules();
-        for (Submodule sm : sms) {
-            sm.update();
-            if (recurse) {
-                Repo repo = Repo::Open(sm);
-                repo.submodulesUpdate(recurse);
-            }
+        std::deque<_SubmoduleUpdate> updates;
+        for (const Submodule& sm : submodules()) {
+            updates.push_back({path(), sm.path()});
         }
+        _SubmodulesUpdate(std::move(updates), recurse);
     }
     
     Reflog reflogForRef(const Ref& ref) const {
@@ -1245,14 +1481,8 @@ public:
         const git_index_entry* ours,
         const git_index_entry* theirs
     ) const {
-        git_merge_file_options opts = {
-            .version = GIT_MERGE_FILE_OPTIONS_VERSION,
-            .our_label = _DebaseProductId,
-            .their_label = _DebaseProductId,
-            // Using the 'patience' algorithm because it seems to remove conflicts
-            // where both sides contain the exact same code
-            .flags = GIT_MERGE_FILE_DIFF_PATIENCE,
-        };
+        git_merge_file_options opts = GIT_MERGE_FILE_OPTIONS_INIT;
+        _MergeFileOptionsSet(opts);
         
         git_merge_file_result x;
         int ir = git_merge_file_from_index(&x, *get(), ancestor, ours, theirs, &opts);
@@ -1349,6 +1579,243 @@ private:
     static bool _HEADSpecialPointer(std::string_view name) {
         return Toastbox::String::EndsWith("HEAD", name);
     }
+    
+    // _MergeFileOptionsSet(): applies the options that we merge file content with
+    static void _MergeFileOptionsSet(git_merge_file_options& opts) {
+        opts.our_label = _DebaseProductId;
+        opts.their_label = _DebaseProductId;
+        // Using the 'patience' algorithm because it seems to remove conflicts
+        // where both sides contain the exact same code
+        opts.flags |= GIT_MERGE_FILE_DIFF_PATIENCE;
+    }
+    
+    // _MergeDriverName: the name of our merge driver, which libgit2 uses to merge the
+    // content of files that both sides changed, unless the file's attributes specify
+    // another driver
+    static constexpr const char _MergeDriverName[] = "debase";
+    
+    // _MergeDriverFiles: where _MergeDriverApply() retains the merge output of conflicted
+    // files, while _MergeFilesRetain() is running on this thread
+    static inline thread_local MergeFiles* _MergeDriverFiles = nullptr;
+    
+    // _MergeDriverApply(): merges a file's content like libgit2's builtin 'text' driver,
+    // but with our merge options, and retains the output if the file has conflicts, so
+    // that ConflictsGet() doesn't need to merge the file again
+    static int _MergeDriverApply(
+        git_merge_driver* driver,
+        const char** pathOut,
+        uint32_t* modeOut,
+        git_buf* mergedOut,
+        const char* filterName,
+        const git_merge_driver_source* src
+    ) {
+        MergeFiles*const files = _MergeDriverFiles;
+        if (!files) return GIT_PASSTHROUGH;
+        
+        const git_index_entry*const ancestor = git_merge_driver_source_ancestor(src);
+        const git_index_entry*const ours = git_merge_driver_source_ours(src);
+        const git_index_entry*const theirs = git_merge_driver_source_theirs(src);
+        
+        git_merge_file_options opts = GIT_MERGE_FILE_OPTIONS_INIT;
+        if (const git_merge_file_options* x = git_merge_driver_source_file_options(src)) opts = *x;
+        _MergeFileOptionsSet(opts);
+        
+        git_merge_file_result x;
+        int ir = git_merge_file_from_index(&x, git_merge_driver_source_repo(src), ancestor, ours, theirs, &opts);
+        if (ir) return ir;
+        MergeFileResult result = x;
+        
+        if (!result->automergeable) {
+            if (ours && theirs) {
+                files->insert_or_assign(ours->path, MergeFile{
+                    .ancestor = (ancestor ? ancestor->id : Id{}),
+                    .ours = ours->id,
+                    .theirs = theirs->id,
+                    .result = result,
+                });
+            }
+            return GIT_EMERGECONFLICT;
+        }
+        
+        // Return the path from the entries rather than `result`, since libgit2 uses
+        // it after `result` is freed
+        *pathOut = nullptr;
+        for (const git_index_entry* entry : {ancestor, ours, theirs}) {
+            if (entry && result->path && !strcmp(entry->path, result->path)) {
+                *pathOut = entry->path;
+                break;
+            }
+        }
+        if (!*pathOut) return GIT_PASSTHROUGH;
+        
+        // Hand the merged content over to libgit2, which frees it
+        *modeOut = result->mode;
+        mergedOut->ptr = (char*)result->ptr;
+        mergedOut->size = result->len;
+        mergedOut->reserved = 0;
+        result->ptr = nullptr;
+        return 0;
+    }
+    
+    // _MergeDriverRegister(): registers our merge driver, if it isn't already
+    // registered (libgit2 forgets it whenever it's fully shut down)
+    static void _MergeDriverRegister() {
+        static std::mutex Lock;
+        static git_merge_driver Driver = {
+            .version = GIT_MERGE_DRIVER_VERSION,
+            .apply = _MergeDriverApply,
+        };
+        
+        auto lock = std::unique_lock(Lock);
+        if (git_merge_driver_lookup(_MergeDriverName)) return;
+        int ir = git_merge_driver_register(_MergeDriverName, &Driver);
+        if (ir) throw Error(ir, "git_merge_driver_register failed");
+    }
+    
+    // _MergeFilesRetain(): performs a merge via `fn`, using our merge driver to retain
+    // the merge output of the conflicted files in the resulting index
+    template <typename T_Fn>
+    static Index _MergeFilesRetain(git_merge_options& opts, T_Fn fn) {
+        _MergeDriverRegister();
+        opts.default_driver = _MergeDriverName;
+        
+        auto files = std::make_shared<MergeFiles>();
+        assert(!_MergeDriverFiles);
+        _MergeDriverFiles = files.get();
+        Defer(_MergeDriverFiles = nullptr);
+        
+        Index index = fn();
+        index.mergeFiles = files;
+        return index;
+    }
+    
+    // _SubmoduleUpdate: a submodule to update, identified by its path within the
+    // working tree of the repository at `repo`
+    struct _SubmoduleUpdate {
+        std::filesystem::path repo;
+        std::filesystem::path path;
+    };
+    
+    // _SubmodulesUpdate(): updates the given submodules on a pool of worker threads,
+    // and with `recurse`, their submodules too, which are scheduled as soon as their
+    // parent is updated. Each update uses its own repository handles, since libgit2
+    // handles can't be shared between threads. Failures don't stop the other updates;
+    // they're reported together once every update is done.
+    static void _SubmodulesUpdate(std::deque<_SubmoduleUpdate> updates, bool recurse) {
+        if (updates.empty()) return;
+        const Trace::Span trace("Repo::submodulesUpdate");
+        
+        struct {
+            std::mutex lock;
+            std::condition_variable signal;
+            std::deque<_SubmoduleUpdate> queue;
+            size_t active = 0;
+            std::vector<std::string> errors;
+        } s;
+        s.queue = std::move(updates);
+        
+        auto work = [&] {
+            Trace::ThreadName("submodule update");
+            for (;;) {
+                _SubmoduleUpdate update;
+                {
+                    auto lock = std::unique_lock(s.lock);
+                    // Wait for work, or until no more work can appear
+                    s.signal.wait(lock, [&] { return !s.queue.empty() || !s.active; });
+                    if (s.queue.empty()) return;
+                    update = std::move(s.queue.front());
+                    s.queue.pop_front();
+                    s.active++;
+                }
+                
+                std::deque<_SubmoduleUpdate> children;
+                std::string err;
+                try {
+                    // `parent` must outlive `sm`, which doesn't retain it
+                    const Repo parent = Repo::Open(update.repo);
+                    Submodule sm = parent.submoduleLookup(update.path);
+                    sm.update();
+                    if (recurse) {
+                        const Repo repo = Repo::Open(sm);
+                        for (const Submodule& child : repo.submodules()) {
+                            children.push_back({repo.path(), child.path()});
+                        }
+                    }
+                
+                } catch (const std::exception& e) {
+                    err = (update.repo / update.path).string() + ": " + e.what();
+                }
+                
+                {
+                    auto lock = std::unique_lock(s.lock);
+                    s.active--;
+                    for (_SubmoduleUpdate& child : children) s.queue.push_back(std::move(child));
+                    if (!err.empty()) s.errors.push_back(err);
+                }
+                s.signal.notify_all();
+            }
+        };
+        
+        // Don't start more threads than there are submodules to begin with; nested
+        // submodules are picked up by whichever threads are available
+        const size_t threadCount = std::min((size_t)std::max(1u, std::thread::hardware_concurrency()), s.queue.size());
+        std::vector<std::thread> threads;
+        for (size_t i=0; i<threadCount; i++) threads.emplace_back(work);
+        for (std::thread& thread : threads) thread.join();
+        
+        if (!s.errors.empty()) {
+            throw RuntimeError("failed to update submodules:\n  %s", String::Join(s.errors, "\n  ").c_str());
+        }
+    }
+    
+    // _checkoutTree(): checks out `tree` using `opts`, throwing ConflictError if
+    // files in the working tree would be overwritten
+    void _checkoutTree(const Tree& tree, git_checkout_options& opts) const {
+        struct Ctx {
+            std::vector<std::filesystem::path> conflicts;
+        };
+        Ctx ctx;
+        
+        opts.notify_flags |= GIT_CHECKOUT_NOTIFY_CONFLICT;
+        opts.notify_payload = &ctx;
+        opts.notify_cb = [] (
+            git_checkout_notify_t why,
+            const char* path,
+            const git_diff_file* baseline,
+            const git_diff_file* target,
+            const git_diff_file* workdir,
+            void* ctxp
+        ) -> int {
+            Ctx& ctx = *(Ctx*)ctxp;
+            if (why == GIT_CHECKOUT_NOTIFY_CONFLICT) {
+                ctx.conflicts.push_back(workdir->path);
+            }
+            return 0;
+        };
+        
+        int ir = git_checkout_tree(*get(), (git_object*)*tree, &opts);
+        if (ir == GIT_ECONFLICT) throw ConflictError(ir, ctx.conflicts);
+        else if (ir)             throw Error(ir, "git_checkout_tree failed");
+    }
+    
+    // _headSet(): points HEAD at `rev`, without touching the index or working tree
+    void _headSet(const Rev& rev) const {
+        if (rev.ref) {
+            const std::string fullName = rev.ref.fullName();
+            int ir = git_repository_set_head(*get(), fullName.c_str());
+            if (ir) throw Error(ir, "git_repository_set_head failed");
+        
+        } else {
+            int ir = git_repository_set_head_detached(*get(), &rev.commit.id());
+            if (ir) throw Error(ir, "git_repository_set_head_detached failed");
+        }
+    }
+    
+    // _traceAttach(): counts our object reads/writes, if tracing is enabled
+    void _traceAttach() const {
+        if (!Trace::Enabled()) return;
+        Trace::OdbAttach(*odb());
+    }
 };
 
 #undef _Equal
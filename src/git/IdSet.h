@@ -0,0 +1,168 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <initializer_list>
+#include "Git.h"
+
+namespace Git {
+
+// IdSet: a set of object ids, stored inline in a flat open-addressing hash table
+// (linear probing, backward-shift deletion).
+//
+// Only the raw 20-byte ids are stored; callers resolve them to Commits with
+// Repo::commitLookup() when they actually need one. The zero id is used to mark
+// empty slots, and is therefore not a valid element.
+class IdSet {
+public:
+    class Iter {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Id;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Id*;
+        using reference = const Id&;
+        
+        Iter(const Id* slot, const Id* end) : _slot(slot), _end(end) { _skip(); }
+        const Id& operator *() const { return *_slot; }
+        const Id* operator ->() const { return _slot; }
+        Iter& operator ++() { _slot++; _skip(); return *this; }
+        bool operator ==(const Iter& x) const { return _slot == x._slot; }
+        bool operator !=(const Iter& x) const { return _slot != x._slot; }
+    private:
+        void _skip() { while (_slot!=_end && git_oid_is_zero(_slot)) _slot++; }
+        const Id* _slot = nullptr;
+        const Id* _end = nullptr;
+    };
+    
+    IdSet() {}
+    
+    IdSet(std::initializer_list<Commit> commits) {
+        for (const Commit& c : commits) insert(c);
+    }
+    
+    Iter begin() const { return Iter(_slots.data(), _slots.data()+_slots.size()); }
+    Iter end() const { return Iter(_slots.data()+_slots.size(), _slots.data()+_slots.size()); }
+    
+    size_t size() const { return _count; }
+    bool empty() const { return !_count; }
+    
+    void clear() {
+        _slots.clear();
+        _count = 0;
+    }
+    
+    bool contains(const Id& id) const {
+        if (_slots.empty()) return false;
+        for (size_t i=_Hash(id)&_mask();; i=(i+1)&_mask()) {
+            const Id& slot = _slots[i];
+            if (git_oid_is_zero(&slot)) return false;
+            if (git_oid_equal(&slot, &id)) return true;
+        }
+    }
+    
+    bool contains(const Commit& commit) const {
+        return commit && contains(commit.id());
+    }
+    
+    // insert(): returns whether `id` was inserted (false if it already existed)
+    bool insert(const Id& id) {
+        assert(!git_oid_is_zero(&id));
+        // Keep the load factor <= 1/2 so that probe sequences stay short
+        if ((_count+1)*2 > _slots.size()) _grow();
+        
+        for (size_t i=_Hash(id)&_mask();; i=(i+1)&_mask()) {
+            Id& slot = _slots[i];
+            if (git_oid_equal(&slot, &id)) return false;
+            if (git_oid_is_zero(&slot)) {
+                slot = id;
+                _count++;
+                return true;
+            }
+        }
+    }
+    
+    bool insert(const Commit& commit) {
+        assert(commit);
+        return insert(commit.id());
+    }
+    
+    // erase(): returns whether `id` was erased (false if it didn't exist)
+    bool erase(const Id& id) {
+        if (_slots.empty()) return false;
+        
+        size_t i = _Hash(id)&_mask();
+        for (;; i=(i+1)&_mask()) {
+            const Id& slot = _slots[i];
+            if (git_oid_is_zero(&slot)) return false;
+            if (git_oid_equal(&slot, &id)) break;
+        }
+        
+        // Backward-shift deletion: move subsequent entries of the probe sequence into
+        // the hole, so that lookups never need tombstones
+        for (size_t j=(i+1)&_mask();; j=(j+1)&_mask()) {
+            Id& slot = _slots[j];
+            if (git_oid_is_zero(&slot)) break;
+            const size_t home = _Hash(slot)&_mask();
+            // Move `slot` into the hole at `i` if its home isn't cyclically within (i,j]
+            const bool stay = (i<=j) ? (i<home && home<=j) : (i<home || home<=j);
+            if (!stay) {
+                _slots[i] = slot;
+                i = j;
+            }
+        }
+        
+        memset(&_slots[i], 0, sizeof(_slots[i]));
+        _count--;
+        return true;
+    }
+    
+    bool erase(const Commit& commit) {
+        return commit && erase(commit.id());
+    }
+    
+    // sorted(): returns the ids in a stable order (for comparison/serialization)
+    std::vector<Id> sorted() const {
+        std::vector<Id> r(begin(), end());
+        std::sort(r.begin(), r.end(), [] (const Id& a, const Id& b) { return git_oid_cmp(&a, &b) < 0; });
+        return r;
+    }
+    
+    bool operator ==(const IdSet& x) const {
+        if (_count != x._count) return false;
+        for (const Id& id : *this) {
+            if (!x.contains(id)) return false;
+        }
+        return true;
+    }
+    
+    bool operator !=(const IdSet& x) const { return !(*this==x); }
+    
+    bool operator <(const IdSet& x) const {
+        const std::vector<Id> a = sorted();
+        const std::vector<Id> b = x.sorted();
+        return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(),
+            [] (const Id& a, const Id& b) { return git_oid_cmp(&a, &b) < 0; });
+    }
+    
+private:
+    static constexpr size_t _CapInit = 8;
+    
+    static size_t _Hash(const Id& id) { return IdHash()(id); }
+    
+    size_t _mask() const { return _slots.size()-1; }
+    
+    void _grow() {
+        std::vector<Id> slots(std::max(_CapInit, _slots.size()*2));
+        std::swap(slots, _slots);
+        _count = 0;
+        for (const Id& id : slots) {
+            if (!git_oid_is_zero(&id)) insert(id);
+        }
+    }
+    
+    std::vector<Id> _slots; // Size is always 0 or a power of 2
+    size_t _count = 0;
+};
+
+} // namespace Git
@@ -0,0 +1,176 @@
+#pragma once
+#include <mutex>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <unordered_map>
+#include <algorithm>
+#include <unistd.h>
+#include "Git.h"
+
+namespace Git {
+
+// MergeCache: remembers the trees produced by rewriting commits onto new parents
+//
+// Rewriting a commit onto a new parent only depends on the commit, the new parent's
+// tree and the file favor, so the resulting tree can be reused whenever the same
+// rewrite happens again (eg undo/redo, or moving a commit back and forth). Only
+// merges that didn't require the user to resolve conflicts are remembered.
+//
+// A merge also depends on the repository's configuration, such as the merge drivers
+// chosen by .gitattributes or .git/info/attributes, which isn't part of the key. So a
+// cache must only be used with the repository that populated it, and its entries can
+// be stale if that configuration changes. A cached tree also doesn't necessarily exist
+// in the repository (eg if the operation that created it was canceled), so callers
+// need to check before using one.
+//
+// Thread-safe, so a single MergeCache can be shared by concurrent operations.
+class MergeCache {
+public:
+    MergeCache() {}
+    
+    // get(): returns the cached tree for rewriting `commit` onto a parent whose tree is
+    // `parentTree` (a zeroed id if the commit is becoming a root commit)
+    std::optional<Id> get(const Id& commit, const Id& parentTree, git_merge_file_favor_t favor) {
+        auto lock = std::unique_lock(_lock);
+        auto find = _entries.find(_Key{commit, parentTree, favor});
+        if (find == _entries.end()) return std::nullopt;
+        find->second.used = ++_useCount;
+        return find->second.tree;
+    }
+    
+    void set(const Id& commit, const Id& parentTree, git_merge_file_favor_t favor, const Id& tree) {
+        auto lock = std::unique_lock(_lock);
+        _entries[_Key{commit, parentTree, favor}] = _Entry{tree, ++_useCount};
+        _changed = true;
+    }
+    
+    // read(): adds the entries stored at `path`, if it exists
+    void read(const std::filesystem::path& path) {
+        const Trace::Span trace("MergeCache::read");
+        _Entries entries = _Read(path);
+        auto lock = std::unique_lock(_lock);
+        _merge(entries);
+    }
+    
+    // write(): stores the most recently used entries at `path`, if any were added
+    // Entries that were written by other sessions since we read `path` are kept too, so
+    // that concurrent sessions don't clobber each other's entries.
+    void write(const std::filesystem::path& path) {
+        const Trace::Span trace("MergeCache::write");
+        {
+            auto lock = std::unique_lock(_lock);
+            if (!_changed) return;
+        }
+        
+        _Entries entries = _Read(path);
+        std::vector<std::pair<_Key,_Entry>> sorted;
+        {
+            auto lock = std::unique_lock(_lock);
+            _merge(entries);
+            sorted.assign(_entries.begin(), _entries.end());
+        }
+        
+        // Keep the most recently used entries, oldest first
+        std::sort(sorted.begin(), sorted.end(), [] (const auto& a, const auto& b) {
+            return a.second.used < b.second.used;
+        });
+        const size_t skip = (sorted.size()>_EntryCountMax ? sorted.size()-_EntryCountMax : 0);
+        
+        std::filesystem::create_directories(path.parent_path());
+        const std::filesystem::path pathTmp = std::filesystem::path(path).concat(".tmp" + std::to_string(getpid()));
+        {
+            std::ofstream f(pathTmp, std::ios::binary);
+            f.exceptions(std::ios::failbit | std::ios::badbit);
+            f.write(_Magic, sizeof(_Magic));
+            for (auto it=sorted.begin()+skip; it!=sorted.end(); it++) {
+                const auto& [key, entry] = *it;
+                const uint8_t favor = key.favor;
+                f.write((const char*)key.commit.id, GIT_OID_RAWSZ);
+                f.write((const char*)key.parentTree.id, GIT_OID_RAWSZ);
+                f.write((const char*)&favor, sizeof(favor));
+                f.write((const char*)entry.tree.id, GIT_OID_RAWSZ);
+            }
+        }
+        std::filesystem::rename(pathTmp, path);
+    }
+    
+private:
+    static constexpr char _Magic[] = {'d','b','m','c', 1}; // Identifier + version
+    static constexpr size_t _RecordLen = 3*GIT_OID_RAWSZ + 1;
+    // Number of entries that write() keeps (~1.2 MB)
+    static constexpr size_t _EntryCountMax = 20000;
+    
+    struct _Key {
+        Id commit;
+        Id parentTree;
+        git_merge_file_favor_t favor;
+    };
+    
+    struct _KeyHash {
+        size_t operator()(const _Key& x) const {
+            return IdHash()(x.commit) ^ (IdHash()(x.parentTree)*31) ^ (size_t)x.favor;
+        }
+    };
+    
+    struct _KeyEqual {
+        bool operator()(const _Key& a, const _Key& b) const {
+            return git_oid_equal(&a.commit, &b.commit) &&
+                git_oid_equal(&a.parentTree, &b.parentTree) &&
+                a.favor==b.favor;
+        }
+    };
+    
+    struct _Entry {
+        Id tree;
+        uint64_t used = 0; // Value of _useCount when the entry was last used
+    };
+    
+    using _Entries = std::vector<std::pair<_Key,Id>>; // Oldest first
+    
+    static _Entries _Read(const std::filesystem::path& path) {
+        std::ifstream f(path, std::ios::binary);
+        if (!f) return {};
+        
+        std::stringstream ss;
+        ss << f.rdbuf();
+        const std::string str = ss.str();
+        // Ignore files that we don't understand (eg written by a different version)
+        if (str.size()<sizeof(_Magic) || memcmp(str.data(), _Magic, sizeof(_Magic))) return {};
+        
+        _Entries r;
+        for (size_t off=sizeof(_Magic); off+_RecordLen<=str.size(); off+=_RecordLen) {
+            const uint8_t* p = (const uint8_t*)str.data()+off;
+            _Key key;
+            Id tree;
+            memcpy(key.commit.id, p, GIT_OID_RAWSZ);
+            memcpy(key.parentTree.id, p+GIT_OID_RAWSZ, GIT_OID_RAWSZ);
+            key.favor = (git_merge_file_favor_t)p[2*GIT_OID_RAWSZ];
+            memcpy(tree.id, p+2*GIT_OID_RAWSZ+1, GIT_OID_RAWSZ);
+            r.push_back({key, tree});
+        }
+        return r;
+    }
+    
+    // _merge(): adds `entries` as less recently used than our own, without replacing
+    // ours; must be called with our lock held
+    void _merge(const _Entries& entries) {
+        // Our counter starts above the number of entries we've merged, so that merged
+        // entries stay less recently used than the ones we use afterwards
+        uint64_t used = 0;
+        for (const auto& [key, tree] : entries) {
+            used++;
+            _entries.insert({key, _Entry{tree, used}});
+        }
+        _useCount = std::max(_useCount, used);
+    }
+    
+    std::mutex _lock;
+    std::unordered_map<_Key,_Entry,_KeyHash,_KeyEqual> _entries;
+    uint64_t _useCount = 0;
+    bool _changed = false;
+};
+
+using MergeCachePtr = std::shared_ptr<MergeCache>;
+
+} // namespace Git
@@ -1,9 +1,17 @@
 #pragma once
 #include <fstream>
 #include <deque>
+#include <unordered_map>
+#include <algorithm>
+#include <future>
+#include <mutex>
 #include "Git.h"
 #include "Conflict.h"
 #include "Editor.h"
+#include "ObjectStage.h"
+#include "MergeCache.h"
+#include "FirstParentIndex.h"
+#include "IdSet.h"
 #include "lib/toastbox/Defer.h"
 #include "lib/toastbox/String.h"
 
@@ -16,7 +24,17 @@ public:
         Repo repo;
         std::function<Ref(const Ref&, const Commit&)> refReplace;
         std::function<void(const char*const*)> spawn;
-        std::function<void(const Index&, const std::vector<Conflict>&)> conflictsResolve;
+        std::function<void(const Index&, ConflictStream&)> conflictsResolve;
+        // progress: optional; called before each commit is rewritten, with the 1-based
+        // index of that commit and the number of commits to rewrite so far. May throw
+        // Canceled to abort the operation before any ref is replaced. Calls are
+        // serialized, but may occur on a thread other than the caller's.
+        std::function<void(size_t, size_t)> progress;
+        // mergeCache: optional; used to skip rewrites that were computed before
+        MergeCachePtr mergeCache;
+        // conflictsAbort: optional; makes conflicts that need the user's input throw
+        // Conflicted instead of calling conflictsResolve, without extracting them
+        bool conflictsAbort = false;
     };
     
     struct Op {
@@ -33,7 +51,7 @@ public:
         
         struct {
             T_Rev rev;
-            std::set<Commit> commits; // Commits to be operated on
+            IdSet commits; // Commits to be operated on
         } src;
         
         struct {
@@ -45,38 +63,86 @@ public:
     struct OpResult {
         struct Res {
             T_Rev rev;
-            std::set<Commit> selection;
-            std::set<Commit> selectionPrev;
+            IdSet selection;
+            IdSet selectionPrev;
         };
         
         Res src;
         Res dst;
     };
     
+    // Prepared: an operation whose commits have been created, but whose refs haven't
+    // been replaced yet. The new objects are held in `stage` until Finish() writes them.
+    struct Prepared {
+        struct Res {
+            T_Rev rev;
+            Commit commit; // New head for `rev`'s ref; null if the ref isn't modified
+            IdSet selection;
+            IdSet selectionPrev;
+        };
+        
+        Res src;
+        Res dst;
+        std::unique_ptr<ObjectStage> stage;
+    };
+    
     class ConflictResolveCanceled : public std::exception {};
+    class Canceled : public std::exception {};
+    class Conflicted : public std::exception {};
     
 private:
-    // _Sorted: sorts a set of commits according to the order that they appear via `c`
-    static std::vector<Commit> _Sorted(Commit head, const std::set<Commit>& commits) {
-        std::vector<Commit> sorted;
-        std::set<Commit> rem = commits;
-        while (!rem.empty()) {
-            if (rem.erase(head)) sorted.push_back(head);
-            head = head.parent();
-        }
-        
-        std::reverse(sorted.begin(), sorted.end());
-        return sorted;
+    // _Steps: tracks the commits rewritten by an operation, for progress reporting
+    // Shared by the threads that rewrite commits concurrently; protected by `lock`.
+    struct _Steps {
+        std::mutex lock;
+        size_t idx = 0;
+        size_t count = 0;
+        bool stop = false; // Set to stop every thread at its next step
+    };
+    
+    // _Ctx: the caller's Ctx, plus state that lives for the duration of Prepare()
+    struct _Ctx : Ctx {
+        _Steps& steps;
+        ObjectStage& stage; // Stage of `repo`
+    };
+    
+    // _ProgressAdd(): adds `count` commits to the number of commits to rewrite
+    static void _ProgressAdd(const _Ctx& ctx, size_t count) {
+        auto lock = std::unique_lock(ctx.steps.lock);
+        ctx.steps.count += count;
+    }
+    
+    // _ProgressStep(): reports that the next commit is about to be rewritten
+    static void _ProgressStep(const _Ctx& ctx) {
+        auto lock = std::unique_lock(ctx.steps.lock);
+        if (ctx.steps.stop) throw Canceled();
+        ctx.steps.idx++;
+        assert(ctx.steps.idx <= ctx.steps.count);
+        if (ctx.progress) ctx.progress(ctx.steps.idx, ctx.steps.count);
+    }
+    
+    // _ProgressStop(): stops the threads that are rewriting commits, at their next step
+    static void _ProgressStop(const _Ctx& ctx) {
+        auto lock = std::unique_lock(ctx.steps.lock);
+        ctx.steps.stop = true;
+    }
+    
+    // _Sorted: sorts a set of commits according to the order that they appear via `head`
+    static std::vector<Commit> _Sorted(Commit head, const IdSet& commits) {
+        if (commits.empty()) return {};
+        return FirstParentIndex(head).sorted(commits);
     }
     
-    static Commit _FindEarliestCommit(Commit head, const std::set<Commit>& commits) {
+    static Commit _FindEarliestCommit(Commit head, const IdSet& commits) {
         assert(!commits.empty());
-        std::set<Commit> rem = commits;
-        while (rem.size() > 1) {
-            rem.erase(head);
-            head = head.parent();
+        const FirstParentIndex index(head);
+        size_t earliestDepth = 0;
+        for (const Id& commit : commits) {
+            const std::optional<size_t> depth = index.depth(commit);
+            assert(depth);
+            earliestDepth = std::max(earliestDepth, *depth);
         }
-        return *rem.begin();
+        return index.at(earliestDepth);
     }
     
     static void _ConflictsHandle(const Ctx& ctx, git_merge_file_favor_t fileFavor, const Index& index) {
@@ -88,14 +154,18 @@ private:
         // In that case, we want to iterate over all the conflicts and choose the 'theirs' side.
         // If fileFavor==GIT_MERGE_FILE_FAVOR_NORMAL, we need to let the user decide how to solve the
         // merge conflict.
-        const std::vector<Conflict> fcs = ConflictsGet(ctx.repo, index);
         switch (fileFavor) {
-        case GIT_MERGE_FILE_FAVOR_NORMAL:
+        case GIT_MERGE_FILE_FAVOR_NORMAL: {
+            if (ctx.conflictsAbort) throw Conflicted();
+            // Hand the conflicts over while they're still being extracted, so that the
+            // first one can be shown as soon as it's ready
+            ConflictStream fcs(ctx.repo, index);
             ctx.conflictsResolve(index, fcs);
             return;
+        }
         case GIT_MERGE_FILE_FAVOR_THEIRS:
-            for (const Conflict& fc : fcs) {
-                ConflictResolve(ctx.repo, index, fc, fc.content(Conflict::Side::Theirs));
+            for (const Conflict& fc : ConflictsGet(ctx.repo, index)) {
+                ConflictResolve(ctx.repo, index, fc, Conflict::Side::Theirs);
             }
             return;
         // Unsupported git_merge_file_favor_t
@@ -104,13 +174,39 @@ private:
         }
     }
     
-    static Commit _CommitParentSet(const Ctx& ctx, git_merge_file_favor_t fileFavor, const Commit& commit, const Commit& parent) {
+    static Commit _CommitParentSet(const _Ctx& ctx, git_merge_file_favor_t fileFavor, const Commit& commit, const Commit& parent) {
+        _ProgressStep(ctx);
+        
+        // If the new parent has the same tree as the old parent, then applying `commit`
+        // on top of it necessarily results in `commit`'s own tree, so skip the merge
+        const Commit parentPrev = commit.parent();
+        if (parent && parentPrev && git_oid_equal(&parent.treeId(), &parentPrev.treeId())) {
+            return ctx.repo.commitParentSetFinish(commit.tree(), commit, parent);
+        }
+        
+        // Reuse the tree from an identical rewrite, if it's still around
+        const Id parentTree = (parent ? parent.treeId() : Id{});
+        if (ctx.mergeCache) {
+            const std::optional<Id> tree = ctx.mergeCache->get(commit.id(), parentTree, fileFavor);
+            if (tree && ctx.repo.objectExists(*tree)) {
+                return ctx.repo.commitParentSetFinish(ctx.repo.treeLookup(*tree), commit, parent);
+            }
+        }
+        
         Index index = ctx.repo.commitParentSet(fileFavor, commit, parent);
+        // Conflicts that the user resolves can be resolved differently next time, so
+        // only remember the result if there were none, or if they were resolved by
+        // favoring 'theirs'
+        const bool cache = (ctx.mergeCache && (!index.conflicts() || fileFavor==GIT_MERGE_FILE_FAVOR_THEIRS));
         _ConflictsHandle(ctx, fileFavor, index);
-        return ctx.repo.commitParentSetFinish(index, commit, parent);
+        const Tree tree = ctx.repo.indexWrite(index);
+        if (cache) ctx.mergeCache->set(commit.id(), parentTree, fileFavor, *git_tree_id(*tree));
+        return ctx.repo.commitParentSetFinish(tree, commit, parent);
     }
     
-    static Commit _CommitIntegrate(const Ctx& ctx, git_merge_file_favor_t fileFavor, const Commit& dst, const Commit& src) {
+    static Commit _CommitIntegrate(const _Ctx& ctx, git_merge_file_favor_t fileFavor, const Commit& dst, const Commit& src) {
+        _ProgressStep(ctx);
+        
         Index index = ctx.repo.commitIntegrate(fileFavor, dst, src);
         _ConflictsHandle(ctx, fileFavor, index);
         return ctx.repo.commitIntegrateFinish(index, dst, src);
@@ -118,17 +214,17 @@ private:
     
     struct _AddRemoveResult {
         Commit commit;
-        std::set<Commit> added;
+        IdSet added;
     };
     
     static _AddRemoveResult _AddRemoveCommits(
-        const Ctx& ctx,
+        const _Ctx& ctx,
         git_merge_file_favor_t fileFavor,
         const Commit& dst,
-        const std::set<Commit>& add,
+        const IdSet& add,
         const Commit& addSrc, // Source of `add` commits (to derive their order)
         const Commit& addPosition, // In `dst`
-        const std::set<Commit>& remove
+        const IdSet& remove
     ) {
         // CommitAdded: wraps a Commit with an additional `added` flag, which tracks whether
         // this is one of the added commits, so that we can put the commit in our returned
@@ -150,7 +246,7 @@ private:
         Commit head;
         {
             const bool adding = !addv.empty();
-            std::set<Commit> r = remove;
+            IdSet r = remove;
             Commit c = dst;
             bool foundAddPoint = false;
             for (;;) {
@@ -180,7 +276,8 @@ private:
         }
         
         // Apply `combined` on top of `head`, and keep track of the added commits
-        std::set<Commit> added;
+        _ProgressAdd(ctx, combined.size());
+        IdSet added;
         for (const CommitAdded& commit : combined) {
             head = _CommitParentSet(ctx, fileFavor, commit.commit, head);
             
@@ -195,35 +292,40 @@ private:
         };
     }
     
-    static bool _CommitsHasGap(const Commit& head, const std::set<Commit>& commits) {
-        Commit h = head;
-        std::set<Commit> rem = commits;
-        bool started = false;
-        while (h && !rem.empty()) {
-            bool found = rem.erase(h);
-            if (started && !found) return true;
-            started |= found;
-            h = h.parent();
+    static bool _CommitsHasGap(const Commit& head, const IdSet& commits) {
+        if (commits.empty()) return false;
+        const FirstParentIndex index(head);
+        size_t depthMin = SIZE_MAX;
+        size_t depthMax = 0;
+        for (const Id& commit : commits) {
+            const std::optional<size_t> depth = index.depth(commit);
+            // `commits` must only contain elements that exist in the `head` tree
+            assert(depth);
+            depthMin = std::min(depthMin, *depth);
+            depthMax = std::max(depthMax, *depth);
         }
-        // If `rem` still has elements, then it's because `commits` contains
-        // elements that don't exist in the `head` tree
-        assert(rem.empty());
-        return false;
+        // `commits` is a set, so they're contiguous iff they span exactly commits.size() depths
+        return (depthMax-depthMin+1) != commits.size();
     }
     
-    static bool _CommitsHasMerge(const std::set<Commit>& commits) {
-        for (const Commit& commit : commits) {
-            if (commit.isMerge()) return true;
+    static bool _CommitsHasMerge(const Repo& repo, const IdSet& commits) {
+        for (const Id& commit : commits) {
+            if (repo.commitLookup(commit).isMerge()) return true;
         }
         return false;
     }
     
-    static bool _InsertionIsNop(const Commit& head, const Commit& position, const std::set<Commit>& commits) {
-        std::set<Commit> positions = commits;
-        const Commit tail = _FindEarliestCommit(head, positions);
+    // _RemovesAll(): returns whether removing `commits` from `head` leaves no commits
+    static bool _RemovesAll(const Commit& head, const IdSet& commits) {
+        if (!commits.contains(head) || _CommitsHasGap(head, commits)) return false;
+        return !_FindEarliestCommit(head, commits).parent();
+    }
+    
+    static bool _InsertionIsNop(const Commit& head, const Commit& position, const IdSet& commits) {
+        if (commits.contains(position)) return true;
+        const Commit tail = _FindEarliestCommit(head, commits);
         // tail.parent()==nullptr is OK and desired, because it represents insertion as the root commit
-        positions.insert(tail.parent());
-        return positions.find(position) != positions.end();
+        return position == tail.parent();
     }
     
     static bool _MoveIsNop(const Op& op) {
@@ -249,7 +351,7 @@ private:
         return GIT_MERGE_FILE_FAVOR_NORMAL;
     }
     
-    static std::optional<OpResult> _MoveCommits(const Ctx& ctx, const Op& op) {
+    static std::optional<Prepared> _MoveCommits(const _Ctx& ctx, const Op& op) {
         // Required arguments:
         assert(op.src.rev);
         assert(op.dst.rev);
@@ -271,21 +373,20 @@ private:
                 ctx,
                 _FileFavor(op.src.rev, op.dst.rev),
                 op.dst.rev.commit,  // dst:         Commit
-                op.src.commits,     // add:         std::set<Commit>
+                op.src.commits,     // add:         IdSet
                 op.src.rev.commit,  // addSrc:      Commit
                 op.dst.position,    // addPosition: Commit
-                op.src.commits      // remove:      std::set<Commit>
+                op.src.commits      // remove:      IdSet
             );
             
             // Replace the branch/tag
-            T_Rev dstRev = op.dst.rev;
-            (Rev&)dstRev = ctx.refReplace(dstRev.ref, srcDstResult.commit);
-            return OpResult{
+            return Prepared{
                 .src = {
                     .rev = op.src.rev,
                 },
                 .dst = {
-                    .rev = dstRev,
+                    .rev = op.dst.rev,
+                    .commit = srcDstResult.commit,
                     .selection = srcDstResult.added,
                     .selectionPrev = op.src.commits,
                 },
@@ -293,49 +394,71 @@ private:
         
         // Move commits between different refs (branches/tags)
         } else {
-            // Remove commits from `op.src`
-            _AddRemoveResult srcResult = _AddRemoveCommits(
-                ctx,
-                _FileFavor(op.src.rev, {}), // Second argument empty because deletion happens within
-                                            // the same ref, so there's no 'destination' for the
-                                            // deletion.
-                                            // More concretely, we want to use fileFavor==_THEIRS
-                                            // to avoid conflicts on the deletion side.
-                op.src.rev.commit,  // dst:         Commit
-                {},                 // add:         std::set<Commit>
-                nullptr,            // addSrc:      Commit
-                nullptr,            // addPosition: Commit
-                op.src.commits      // remove:      std::set<Commit>
-            );
-            
-            if (!srcResult.commit) {
+            // Check upfront whether removing the commits would empty `op.src`, rather
+            // than after the user has resolved the destination side's conflicts
+            if (_RemovesAll(op.src.rev.commit, op.src.commits)) {
                 throw RuntimeError("can't move last commit");
             }
             
+            // Remove commits from `op.src` on another thread, while we add them to
+            // `op.dst` on this one. The two sides rewrite disjoint chains of commits, so
+            // the removal only needs its own repository handle, and its own stage (which
+            // we adopt once it's done), since neither can be shared between threads.
+            // It never prompts, so any conflict resolution happens on our thread.
+            const Repo srcRepo = ctx.repo.reopen();
+            ObjectStage srcStage(srcRepo);
+            std::future<Commit> srcFuture = std::async(std::launch::async, [&] {
+                Trace::ThreadName("move source");
+                const _Ctx srcCtx = {{.repo = srcRepo, .progress = ctx.progress, .mergeCache = ctx.mergeCache}, ctx.steps, srcStage};
+                return _AddRemoveCommits(
+                    srcCtx,
+                    _FileFavor(op.src.rev, {}), // Second argument empty because deletion happens within
+                                                // the same ref, so there's no 'destination' for the
+                                                // deletion.
+                                                // More concretely, we want to use fileFavor==_THEIRS
+                                                // to avoid conflicts on the deletion side.
+                    srcRepo.commitLookup(op.src.rev.commit.id()), // dst:         Commit
+                    {},                                           // add:         IdSet
+                    nullptr,                                      // addSrc:      Commit
+                    nullptr,                                      // addPosition: Commit
+                    op.src.commits                                // remove:      IdSet
+                ).commit;
+            });
+            
             // Add commits to `op.dst`
-            _AddRemoveResult dstResult = _AddRemoveCommits(
-                ctx,
-                _FileFavor(op.src.rev, op.dst.rev),
-                op.dst.rev.commit,  // dst:         Commit
-                op.src.commits,     // add:         std::set<Commit>
-                op.src.rev.commit,  // addSrc:      Commit
-                op.dst.position,    // addPosition: Commit
-                {}                  // remove:      std::set<Commit>
-            );
+            _AddRemoveResult dstResult;
+            try {
+                dstResult = _AddRemoveCommits(
+                    ctx,
+                    _FileFavor(op.src.rev, op.dst.rev),
+                    op.dst.rev.commit,  // dst:         Commit
+                    op.src.commits,     // add:         IdSet
+                    op.src.rev.commit,  // addSrc:      Commit
+                    op.dst.position,    // addPosition: Commit
+                    {}                  // remove:      IdSet
+                );
+            } catch (...) {
+                // Stop removing before unwinding, since the removal uses our stack
+                _ProgressStop(ctx);
+                srcFuture.wait();
+                throw;
+            }
+            
+            const Commit srcCommit = srcFuture.get();
+            assert(srcCommit);
+            ctx.stage.adopt(srcStage, srcCommit);
             
             // Replace the source and destination branches/tags
-            T_Rev srcRev = op.src.rev;
-            T_Rev dstRev = op.dst.rev;
-            (Rev&)srcRev = ctx.refReplace(srcRev.ref, srcResult.commit);
-            (Rev&)dstRev = ctx.refReplace(dstRev.ref, dstResult.commit);
-            return OpResult{
+            return Prepared{
                 .src = {
-                    .rev = srcRev,
+                    .rev = op.src.rev,
+                    .commit = ctx.repo.commitLookup(srcCommit.id()),
                     .selection = {},
                     .selectionPrev = op.src.commits,
                 },
                 .dst = {
-                    .rev = dstRev,
+                    .rev = op.dst.rev,
+                    .commit = dstResult.commit,
                     .selection = dstResult.added,
                     .selectionPrev = {},
                 },
@@ -343,7 +466,7 @@ private:
         }
     }
     
-    static std::optional<OpResult> _CopyCommits(const Ctx& ctx, const Op& op) {
+    static std::optional<Prepared> _CopyCommits(const _Ctx& ctx, const Op& op) {
         // Required arguments:
         assert(op.src.rev);
         assert(op.dst.rev);
@@ -355,28 +478,27 @@ private:
             ctx,
             _FileFavor(op.src.rev, op.dst.rev),
             op.dst.rev.commit,  // dst:         Commit
-            op.src.commits,     // add:         std::set<Commit>
+            op.src.commits,     // add:         IdSet
             op.src.rev.commit,  // addSrc:      Commit
             op.dst.position,    // addPosition: Commit
-            {}                  // remove:      std::set<Commit>
+            {}                  // remove:      IdSet
         );
         
         // Replace the destination branch/tag
-        T_Rev dstRev = op.dst.rev;
-        (Rev&)dstRev = ctx.refReplace(dstRev.ref, dstResult.commit);
-        return OpResult{
+        return Prepared{
             .src = {
                 .rev = op.src.rev,
             },
             .dst = {
-                .rev = dstRev,
+                .rev = op.dst.rev,
+                .commit = dstResult.commit,
                 .selection = dstResult.added,
                 .selectionPrev = {},
             },
         };
     }
     
-    static std::optional<OpResult> _DeleteCommits(const Ctx& ctx, const Op& op) {
+    static std::optional<Prepared> _DeleteCommits(const _Ctx& ctx, const Op& op) {
         // Required arguments:
         assert(op.src.rev);
         // Illegal arguments:
@@ -389,10 +511,10 @@ private:
             ctx,
             _FileFavor(op.src.rev, {}),
             op.src.rev.commit,  // dst:         Commit
-            {},                 // add:         std::set<Commit>
+            {},                 // add:         IdSet
             nullptr,            // addSrc:      Commit
             nullptr,            // addPosition: Commit
-            op.src.commits      // remove:      std::set<Commit>
+            op.src.commits      // remove:      IdSet
         );
         
         if (!srcResult.commit) {
@@ -400,18 +522,17 @@ private:
         }
         
         // Replace the source branch/tag
-        T_Rev srcRev = op.src.rev;
-        (Rev&)srcRev = ctx.refReplace(srcRev.ref, srcResult.commit);
-        return OpResult{
+        return Prepared{
             .src = {
-                .rev = srcRev,
+                .rev = op.src.rev,
+                .commit = srcResult.commit,
                 .selection = {},
                 .selectionPrev = op.src.commits,
             },
         };
     }
     
-    static std::optional<OpResult> _CombineCommits(const Ctx& ctx, const Op& op) {
+    static std::optional<Prepared> _CombineCommits(const _Ctx& ctx, const Op& op) {
         // Required arguments:
         assert(op.src.rev);
         // Illegal arguments:
@@ -419,13 +540,14 @@ private:
         
         if (!op.src.rev.ref) throw RuntimeError("source must be a reference (branch or tag)");
         if (op.src.commits.size() < 2) throw RuntimeError("at least 2 commits are required to combine");
-        if (_CommitsHasMerge(op.src.commits)) throw RuntimeError("can't combine with merge commit");
+        if (_CommitsHasMerge(ctx.repo, op.src.commits)) throw RuntimeError("can't combine with merge commit");
         
         std::deque<Commit> integrate; // Commits that need to be integrated into a single commit
         std::deque<Commit> attach;    // Commits that need to be attached after the integrate step
         Commit head;
+        bool gap = false; // Whether any unselected commits lie between the selected ones
         {
-            std::set<Commit> rem = op.src.commits;
+            IdSet rem = op.src.commits;
             head = op.src.rev.commit;
             for (;;) {
                 if (!head) throw RuntimeError("ran out of commits");
@@ -433,29 +555,44 @@ private:
                 if (rem.empty()) break;
                 if (erased) integrate.push_front(head);
                 else        attach.push_front(head);
+                gap |= (!erased && !integrate.empty());
                 head = head.parent();
             }
         }
         
         // Combine `head` with all the commits in `integrate`
-        for (const Commit& commit : integrate) {
-            head = _CommitIntegrate(ctx, _FileFavor(op.src.rev, {}), head, commit);
+        if (!gap) {
+            // The commits are contiguous, so integrating each one into its parent
+            // trivially yields that commit's tree. So skip the merges, and create the
+            // combined commit directly.
+            _ProgressAdd(ctx, 1+attach.size());
+            _ProgressStep(ctx);
+            std::vector<Commit> commits = {head};
+            commits.insert(commits.end(), integrate.begin(), integrate.end());
+            head = ctx.repo.commitsIntegrate(commits);
+        
+        } else {
+            _ProgressAdd(ctx, integrate.size()+attach.size());
+            for (const Commit& commit : integrate) {
+                head = _CommitIntegrate(ctx, _FileFavor(op.src.rev, {}), head, commit);
+            }
         }
         
         // Remember the final commit containing all the integrated commits
         Commit integrated = head;
         
         // Attach every commit in `attach` to `head`
+        // In the contiguous case, `head` has the same tree as the newest combined
+        // commit, so _CommitParentSet() reattaches these without merging.
         for (const Commit& commit : attach) {
             head = _CommitParentSet(ctx, _FileFavor(op.src.rev, {}), commit, head);
         }
         
         // Replace the source branch/tag
-        T_Rev srcRev = op.src.rev;
-        (Rev&)srcRev = ctx.refReplace(srcRev.ref, head);
-        return OpResult{
+        return Prepared{
             .src = {
-                .rev = srcRev,
+                .rev = op.src.rev,
+                .commit = head,
                 .selection = {integrated},
                 .selectionPrev = op.src.commits,
             },
@@ -583,86 +720,235 @@ private:
         };
     }
     
-    static std::optional<OpResult> _EditCommit(const Ctx& ctx, const Op& op) {
+    using _CommitMessages = std::unordered_map<Id,_CommitMessage,IdHash,IdEqual>;
+    
+    static constexpr const char _CommitSeparatorPrefix[] = "=== commit ";
+    static constexpr const char _CommitSeparatorSuffix[] = " ===";
+    
+    // _StringFromCommitMessages(): serializes the messages of `commits` into a single string,
+    // as blocks that each start with a separator line identifying the commit
+    // A single commit is serialized without a separator, exactly like before multiple
+    // commits could be edited at once.
+    static std::string _StringFromCommitMessages(const std::vector<Commit>& commits,
+        const _CommitMessages& msgs) {
+        
+        if (commits.size() == 1) return _StringFromCommitMessage(msgs.at(commits[0].id()));
+        
+        std::string r;
+        for (const Commit& commit : commits) {
+            if (!r.empty()) r += '\n';
+            r += std::string(_CommitSeparatorPrefix) + commit.idStr() + _CommitSeparatorSuffix + '\n';
+            r += _StringFromCommitMessage(msgs.at(commit.id()));
+        }
+        return r;
+    }
+    
+    // _CommitMessagesFromString(): parses the blocks written by _StringFromCommitMessages()
+    // Commits whose block was removed don't appear in the result.
+    static _CommitMessages _CommitMessagesFromString(const std::vector<Commit>& commits, std::string_view str) {
+        if (commits.size() == 1) return {{commits[0].id(), _CommitMessageFromString(str)}};
+        
+        _CommitMessages r;
+        std::optional<Id> id;
+        std::string block;
+        auto blockFinish = [&] {
+            if (!id) return;
+            // Remove the newline that separates the block from the next one
+            if (!block.empty() && block.back()=='\n') block.pop_back();
+            if (!r.insert({*id, _CommitMessageFromString(block)}).second) {
+                throw RuntimeError("commit %s appears more than once", StringFromId(*id).c_str());
+            }
+        };
+        
+        for (const std::string& line : String::Split(str, "\n")) {
+            if (String::StartsWith(_CommitSeparatorPrefix, line)) {
+                blockFinish();
+                std::string idStr = line.substr(std::size(_CommitSeparatorPrefix)-1);
+                idStr = idStr.substr(0, idStr.find(_CommitSeparatorSuffix));
+                
+                id = IdFromString(String::Trim(idStr));
+                const bool known = std::any_of(commits.begin(), commits.end(),
+                    [&] (const Commit& c) { return git_oid_equal(&c.id(), &*id); });
+                if (!known) throw RuntimeError("unknown commit: %s", StringFromId(*id).c_str());
+                block.clear();
+                continue;
+            }
+            
+            // Ignore anything before the first separator
+            if (id) block += line + '\n';
+        }
+        
+        blockFinish();
+        return r;
+    }
+    
+    static std::optional<Prepared> _EditCommits(const _Ctx& ctx, const Op& op) {
         // Required arguments:
         assert(op.src.rev);
-        assert(op.src.commits.size() == 1); // Programmer error
+        assert(!op.src.commits.empty()); // Programmer error
         // Illegal arguments:
         assert(!op.dst.rev);
         
         if (!op.src.rev.ref) throw RuntimeError("source must be a reference (branch or tag)");
         
-        // Write the commit message to the file
-        const Commit origCommit = *op.src.commits.begin();
-        const git_signature* origAuthor = git_commit_author(*origCommit);
-        const _CommitMessage origMsg = _CommitMessageForCommit(origCommit);
+        // Write the commit messages to the file, latest commit first (like `git log`)
+        std::vector<Commit> commits = _Sorted(op.src.rev.commit, op.src.commits);
+        std::reverse(commits.begin(), commits.end());
+        
+        _CommitMessages origMsgs;
+        for (const Commit& commit : commits) origMsgs[commit.id()] = _CommitMessageForCommit(commit);
         
         // _CommitMessage -> String
-        const std::string origMsgStr = _StringFromCommitMessage(origMsg);
+        const std::string origMsgsStr = _StringFromCommitMessages(commits, origMsgs);
         
         // Execute the editor and read back the result
-        const std::string newMsgStr = EditorRun(ctx.repo, ctx.spawn, origMsgStr);
+        const std::string newMsgsStr = EditorRun(ctx.repo, ctx.spawn, origMsgsStr);
         
         // String -> _CommitMessage
-        const _CommitMessage newMsg = _CommitMessageFromString(newMsgStr);
+        const _CommitMessages newMsgs = _CommitMessagesFromString(commits, newMsgsStr);
         
-        // Nop if the message wasn't changed
-        if (origMsg == newMsg) return std::nullopt;
+        // Amend the commits whose message changed
+        std::unordered_map<Id,Commit,IdHash,IdEqual> amended;
+        for (const Commit& commit : commits) {
+            const auto find = newMsgs.find(commit.id());
+            // Leave the commit alone if its block was removed, or its message wasn't changed
+            if (find == newMsgs.end()) continue;
+            const _CommitMessage& newMsg = find->second;
+            if (origMsgs.at(commit.id()) == newMsg) continue;
+        
+            // Construct a new signature, using the original signature values if a new value didn't exist
+            const git_signature* origAuthor = git_commit_author(*commit);
+            const char* newName = newMsg.author ? newMsg.author->name.c_str() : origAuthor->name;
+            const char* newEmail = newMsg.author ? newMsg.author->email.c_str() : origAuthor->email;
+            time_t newTime = newMsg.time ? newMsg.time->time : origAuthor->when.time;
+            int newOffset = newMsg.time ? newMsg.time->offset : origAuthor->when.offset;
+            const Signature newAuthor = Signature::Create(newName, newEmail, newTime, newOffset);
+            amended[commit.id()] = ctx.repo.commitAmend(commit, newAuthor, newMsg.message);
+        }
         
-        // Construct a new signature, using the original signature values if a new value didn't exist
-        const char* newName = newMsg.author ? newMsg.author->name.c_str() : origAuthor->name;
-        const char* newEmail = newMsg.author ? newMsg.author->email.c_str() : origAuthor->email;
-        time_t newTime = newMsg.time ? newMsg.time->time : origAuthor->when.time;
-        int newOffset = newMsg.time ? newMsg.time->offset : origAuthor->when.offset;
-        const Signature newAuthor = Signature::Create(newName, newEmail, newTime, newOffset);
-        const Commit newCommit = ctx.repo.commitAmend(origCommit, newAuthor, newMsg.message);
+        // Nop if no message was changed
+        if (amended.empty()) return std::nullopt;
         
-        // Rewrite the rev
-        // Add and remove commits
-        _AddRemoveResult srcResult = _AddRemoveCommits(
-            ctx,
-            _FileFavor(op.src.rev, {}),
-            op.src.rev.commit,  // dst:         Commit
-            {newCommit},        // add:         std::set<Commit>
-            newCommit,          // addSrc:      Commit
-            origCommit,         // addPosition: Commit
-            {origCommit}        // remove:      std::set<Commit>
-        );
+        // Collect the commits from the earliest amended commit to the head
+        std::deque<Commit> rewrite;
+        Commit head = op.src.rev.commit;
+        for (size_t remaining=amended.size(); remaining;) {
+            assert(head);
+            if (amended.count(head.id())) remaining--;
+            rewrite.push_front(head);
+            head = head.parent();
+        }
+        
+        // Rewrite the rev in a single pass, substituting the amended commits
+        // Amending doesn't change any trees, so every commit is reattached without merging.
+        // The selected commits stay selected, under their new ids.
+        _ProgressAdd(ctx, rewrite.size());
+        IdSet selection = op.src.commits;
+        for (const Commit& commit : rewrite) {
+            const auto find = amended.find(commit.id());
+            head = _CommitParentSet(ctx, _FileFavor(op.src.rev, {}), (find!=amended.end() ? find->second : commit), head);
+            if (selection.erase(commit)) selection.insert(head);
+        }
         
         // Replace the source branch/tag
-        T_Rev srcRev = op.src.rev;
-        (Rev&)srcRev = ctx.refReplace(srcRev.ref, srcResult.commit);
-        return OpResult{
+        return Prepared{
             .src = {
-                .rev = srcRev,
-                .selection = srcResult.added,
+                .rev = op.src.rev,
+                .commit = head,
+                .selection = selection,
                 .selectionPrev = op.src.commits,
             },
         };
     }
     
 public:
-    static std::optional<OpResult> Exec(const Ctx& ctx, const Op& op) {
+    // Prepare(): performs the first half of Exec(), by creating the operation's commits
+    // without writing them to disk or replacing any refs
+    // Returns nullopt if the operation is a nop, or if it was canceled.
+    static std::optional<Prepared> Prepare(const Ctx& ctx, const Op& op) {
+        const Trace::Span trace("Modify::Prepare");
         try {
+            // Stage the objects that the operation creates in memory, so that only
+            // the ones that end up reachable from the replaced refs get written to
+            // disk, and a canceled operation writes nothing
+            auto stage = std::make_unique<ObjectStage>(ctx.repo);
+            _Steps steps;
+            const _Ctx c = {ctx, steps, *stage};
+            std::optional<Prepared> r;
             switch (op.type) {
             case Op::Type::None:    return std::nullopt;
-            case Op::Type::Move:    return _MoveCommits(ctx, op);
-            case Op::Type::Copy:    return _CopyCommits(ctx, op);
-            case Op::Type::Delete:  return _DeleteCommits(ctx, op);
-            case Op::Type::Combine: return _CombineCommits(ctx, op);
-            case Op::Type::Edit:    return _EditCommit(ctx, op);
+            case Op::Type::Move:    r = _MoveCommits(c, op); break;
+            case Op::Type::Copy:    r = _CopyCommits(c, op); break;
+            case Op::Type::Delete:  r = _DeleteCommits(c, op); break;
+            case Op::Type::Combine: r = _CombineCommits(c, op); break;
+            case Op::Type::Edit:    r = _EditCommits(c, op); break;
+            default:                abort();
             }
-            abort();
+            
+            if (r) r->stage = std::move(stage);
+            return r;
         
         } catch (const ConflictResolveCanceled&) {
             // Conflict resolution was canceled
             return std::nullopt;
         
+        } catch (const Canceled&) {
+            // Operation was canceled between commits; no refs were replaced, and
+            // `stage` discards the objects that were created
+            return std::nullopt;
+        
         } catch (...) {
             throw;
         }
     }
 
+    // Finish(): performs the second half of Exec(), by writing the objects created by
+    // Prepare() to disk and replacing the refs
+    // `ctx.repo` must be the repo that `prepared` was created with.
+    static OpResult Finish(const Ctx& ctx, Prepared prepared) {
+        const Trace::Span trace("Modify::Finish");
+        Prepared& p = prepared;
+        
+        // Write the objects for both refs together, so they land in a single pack
+        std::vector<Commit> heads;
+        if (p.src.commit) heads.push_back(p.src.commit);
+        if (p.dst.commit) heads.push_back(p.dst.commit);
+        p.stage->write(heads);
+        
+        OpResult r = {
+            .src = {
+                .rev = p.src.rev,
+                .selection = p.src.selection,
+                .selectionPrev = p.src.selectionPrev,
+            },
+            .dst = {
+                .rev = p.dst.rev,
+                .selection = p.dst.selection,
+                .selectionPrev = p.dst.selectionPrev,
+            },
+        };
+        
+        if (p.src.commit) (Rev&)r.src.rev = ctx.refReplace(p.src.rev.ref, p.src.commit);
+        if (p.dst.commit) (Rev&)r.dst.rev = ctx.refReplace(p.dst.rev.ref, p.dst.commit);
+        return r;
+    }
+    
+    static std::optional<OpResult> Exec(const Ctx& ctx, const Op& op) {
+        const Trace::Span trace("Modify::Exec");
+        try {
+            std::optional<Prepared> prepared = Prepare(ctx, op);
+            if (!prepared) return std::nullopt;
+            return Finish(ctx, std::move(*prepared));
+        
+        } catch (const Canceled&) {
+            // Operation was canceled before its refs were replaced
+            return std::nullopt;
+        
+        } catch (...) {
+            throw;
+        }
+    }
+    
 }; // class Modify
 
 } // namespace Git
@@ -0,0 +1,181 @@
+#pragma once
+#include <set>
+#include <functional>
+#include "Git.h"
+#include "lib/libgit2/include/git2/sys/mempack.h"
+#include "lib/libgit2/include/git2/sys/odb_backend.h"
+
+namespace Git {
+
+// ObjectStage: redirects every object that `repo` writes into an in-memory object
+// database, for the lifetime of the ObjectStage.
+//
+// Objects only reach disk via write(), which stores the staged objects that are
+// reachable from the supplied commits as a single packfile, and then ends staging.
+// Everything else is discarded, so an abandoned operation leaves nothing behind in
+// .git/objects.
+class ObjectStage {
+public:
+    ObjectStage(const Repo& repo) : _repo(repo) {
+        _odbDisk = _repo.odb();
+        // Pick up packs written by other processes once upfront, so that our
+        // _diskHas() checks don't need to rescan the pack directory on every miss
+        git_odb_refresh(*_odbDisk);
+        
+        {
+            git_odb* x = nullptr;
+            int ir = git_odb_new(&x);
+            if (ir) throw Error(ir, "git_odb_new failed");
+            _odbMem = x;
+        }
+        
+        // Writes go to the mempack backend; reads fall through to the repo's
+        // object directory, which is added as an alternate so that it's never
+        // written to
+        {
+            git_odb_backend* x = nullptr;
+            int ir = git_mempack_new(&x);
+            if (ir) throw Error(ir, "git_mempack_new failed");
+            ir = git_odb_add_backend(*_odbMem, x, _MempackPriority);
+            if (ir) {
+                x->free(x);
+                throw Error(ir, "git_odb_add_backend failed");
+            }
+        }
+        
+        {
+            int ir = git_odb_add_disk_alternate(*_odbMem, _repo.objectsPath().c_str());
+            if (ir) throw Error(ir, "git_odb_add_disk_alternate failed");
+        }
+        
+        if (Trace::Enabled()) Trace::OdbAttach(*_odbMem);
+        
+        _repo.odbSet(_odbMem);
+        _active = true;
+    }
+    
+    ~ObjectStage() {
+        _end();
+    }
+    
+    ObjectStage(const ObjectStage&) = delete;
+    ObjectStage& operator=(const ObjectStage&) = delete;
+    
+    // write(): writes the staged objects reachable from `heads` to disk, as a
+    // single packfile. Must be called before any ref is pointed at one of `heads`.
+    // Objects created after write() (eg annotated tags created when replacing
+    // refs) are written to disk directly.
+    void write(const std::vector<Commit>& heads) {
+        const Trace::Span trace("ObjectStage::write");
+        assert(_active);
+        Defer(_end());
+        
+        PackBuilder pb = _repo.packBuilderCreate();
+        _walk(heads, [&] (const Id& id) {
+            int ir = git_packbuilder_insert(*pb, &id, nullptr);
+            if (ir) throw Error(ir, "git_packbuilder_insert failed");
+        });
+        
+        if (!git_packbuilder_object_count(*pb)) return;
+        
+        int ir = git_packbuilder_write(*pb, nullptr, 0, nullptr, nullptr);
+        if (ir) throw Error(ir, "git_packbuilder_write failed");
+        
+        // Make the new pack visible to the on-disk odb, which _end() restores
+        ir = git_odb_refresh(*_odbDisk);
+        if (ir) throw Error(ir, "git_odb_refresh failed");
+    }
+    
+    // adopt(): copies the objects staged by `stage` that are reachable from `head` into
+    // our stage, so that write() writes them along with our own
+    // This allows objects to be created concurrently via separate repository handles
+    // (each with its own stage), and written as a single pack. `stage` must not be in
+    // use by another thread.
+    void adopt(const ObjectStage& stage, const Commit& head) {
+        const Trace::Span trace("ObjectStage::adopt");
+        assert(_active);
+        assert(stage._active);
+        
+        stage._walk({head}, [&] (const Id& id) {
+            git_odb_object* obj = nullptr;
+            int ir = git_odb_read(&obj, *stage._odbMem, &id);
+            if (ir) throw Error(ir, "git_odb_read failed");
+            Defer(git_odb_object_free(obj));
+            
+            Id written;
+            ir = git_odb_write(&written, *_odbMem, git_odb_object_data(obj),
+                git_odb_object_size(obj), git_odb_object_type(obj));
+            if (ir) throw Error(ir, "git_odb_write failed");
+        });
+    }
+    
+private:
+    // Must be greater than the priority of the default loose/packed backends
+    static constexpr int _MempackPriority = 1000;
+    
+    struct _IdLess {
+        bool operator()(const Id& a, const Id& b) const { return git_oid_cmp(&a, &b) < 0; }
+    };
+    
+    void _end() {
+        if (!_active) return;
+        // Can't throw from here because we're called from our destructor;
+        // git_repository_set_odb() only fails for invalid arguments anyway
+        git_repository_set_odb(*_repo, *_odbDisk);
+        _active = false;
+    }
+    
+    bool _diskHas(const Id& id) const {
+        return git_odb_exists_ext(*_odbDisk, &id, GIT_ODB_LOOKUP_NO_REFRESH);
+    }
+    
+    // _walk(): calls `fn` for each staged object that's reachable from `heads`, in
+    // dependency order
+    void _walk(const std::vector<Commit>& heads, const std::function<void(const Id&)>& fn) const {
+        std::set<Id,_IdLess> seen;
+        std::vector<Commit> commits(heads.begin(), heads.end());
+        while (!commits.empty()) {
+            const Commit c = commits.back();
+            commits.pop_back();
+            // Stop at commits that already exist on disk; everything they
+            // reference exists on disk too
+            if (!c || _diskHas(c.id()) || !seen.insert(c.id()).second) continue;
+            
+            _treeWalk(seen, c.tree(), fn);
+            fn(c.id());
+            for (const Commit& p : c.parents()) commits.push_back(p);
+        }
+    }
+    
+    void _treeWalk(std::set<Id,_IdLess>& seen, const Tree& tree, const std::function<void(const Id&)>& fn) const {
+        const Id& treeId = *git_tree_id(*tree);
+        if (_diskHas(treeId) || !seen.insert(treeId).second) return;
+        
+        const size_t count = git_tree_entrycount(*tree);
+        for (size_t i=0; i<count; i++) {
+            const git_tree_entry* entry = git_tree_entry_byindex(*tree, i);
+            const Id& id = *git_tree_entry_id(entry);
+            switch (git_tree_entry_type(entry)) {
+            case GIT_OBJECT_TREE:
+                _treeWalk(seen, _repo.treeLookup(id), fn);
+                break;
+            case GIT_OBJECT_BLOB:
+                if (!_diskHas(id) && seen.insert(id).second) fn(id);
+                break;
+            // Gitlinks (GIT_OBJECT_COMMIT) refer to objects in a submodule's
+            // repo, so they're never ours to write
+            default:
+                break;
+            }
+        }
+        
+        fn(treeId);
+    }
+    
+    Repo _repo;
+    Odb _odbDisk;
+    Odb _odbMem;
+    bool _active = false;
+};
+
+} // namespace Git
@@ -4,6 +4,7 @@
 #include "lib/toastbox/Stringify.h"
 #include "lib/toastbox/String.h"
 #include "App.h"
+#include "Batch.h"
 #include "Terminal.h"
 #include "Debase.h"
 #include "DebaseGitHash.h"
@@ -11,13 +12,19 @@
 #include "LibsText.h"
 #include "Syscall.h"
 #include "Rev.h"
+#include "Trace.h"
 
 struct _Args {
     struct {
         bool en = false;
         std::vector<std::string> revs;
+        std::filesystem::path trace;
     } run;
     
+    struct {
+        bool en = false;
+    } batch;
+    
     struct {
         bool en = false;
     } help;
@@ -62,6 +69,22 @@ static _Args _ParseArgs(int argc, const char* argv[]) {
         };
     }
     
+    if (arg0 == "--trace") {
+        if (strs.size() < 2) throw std::runtime_error("no trace file specified");
+        return _Args{
+            .run = {
+                .en = true,
+                .revs = std::vector<std::string>(strs.begin()+2, strs.end()),
+                .trace = strs[1],
+            },
+        };
+    }
+    
+    if (arg0 == "--batch") {
+        if (strs.size() > 1) throw std::runtime_error("too many arguments supplied");
+        return _Args{ .batch = {.en = true}, };
+    }
+    
     if (arg0 == "--libs") {
         return _Args{
             .libs = {
@@ -138,15 +161,9 @@ Rev _RevLookup(const Git::Repo& repo, const std::string& str) {
     
     // If we found a `skipRev.ref` by removing the ^~ suffix, calculate the `skip` value
     if (skipRev.ref) {
-        size_t skip = 0;
-        Git::Commit head = skipRev.commit;
-        while (head && head!=rev.commit) {
-            head = head.parent();
-            skip++;
-        }
-        
-        if (head) {
-            skipRev.skip = skip;
+        const std::optional<size_t> skip = Git::FirstParentIndex(skipRev.commit).depth(rev.commit);
+        if (skip) {
+            skipRev.skip = *skip;
             return skipRev;
         }
     }
@@ -183,8 +200,6 @@ int main(int argc, const char* argv[]) {
     #warning TODO:   need to handle tabs properly -- do the de-indenting after filtering the text (which replaces
     #warning TODO:   tabs with spaces)
     
-    #warning TODO: add scrolling
-    
     #warning TODO: integrate debase-releases as a submodule into debase.
     #warning TODO: invoke with `make release`; its tasks are:
     #warning TODO:   - in the debase repo: create a tag `v<VersionNumber>`
@@ -199,10 +214,6 @@ int main(int argc, const char* argv[]) {
     
     #warning TODO: move commits away from dragged commits to show where the commits will land
     
-    #warning TODO: add column scrolling
-    
-    #warning TODO: if we cant speed up git operations, show a progress indicator
-    
     #warning TODO: figure out why moving/copying commits is slow sometimes
     
     try {
@@ -211,6 +222,11 @@ int main(int argc, const char* argv[]) {
         if (args.run.en) {
             // Nothing to do
         
+        } else if (args.batch.en) {
+            // Batch mode doesn't involve the terminal, so skip all of the setup below
+            Batch batch(Git::Repo::Open("."));
+            return (batch.run(std::cin, std::cout) ? 0 : 1);
+        
         } else if (args.help.en) {
             _PrintUsage();
             return 0;
@@ -259,6 +275,9 @@ int main(int argc, const char* argv[]) {
         
         setlocale(LC_ALL, "");
         
+        // Start tracing before opening the repository, so that its object reads/writes are counted
+        if (!args.run.trace.empty()) Trace::Start(args.run.trace);
+        
         Git::Repo repo;
         std::vector<Rev> revs;
         try {
@@ -273,62 +292,39 @@ int main(int argc, const char* argv[]) {
 //        repo.headDetach();
 //        exit(0);
         
+        // Resolve the supplied revs. If none were supplied, App determines the default revs
+        // itself, while it waits for the terminal to report its background color.
         if (repo) {
-            if (args.run.revs.empty()) {
-                constexpr size_t RevCountDefault = 5;
-                std::set<Rev> unique;
-                
-                // Add HEAD to `revs`
-                {
-                    Rev rev;
-                    (Git::Rev&)rev = repo.headResolved();
-                    revs.emplace_back(rev);
-                    unique.insert(rev);
+            // Unique the supplied revs, because our code assumes a 1:1 mapping between Revs and RevColumns
+            std::set<Rev> unique;
+            for (const std::string& revName : args.run.revs) {
+                Rev rev;
+                try {
+                    rev = _RevLookup(repo, revName);
+                } catch (...) {
+                    throw Toastbox::RuntimeError("invalid rev: %s", revName.c_str());
                 }
                 
-                // Fill out `revs` with recent revs that were checked out, until we hit `RevCountDefault`
-                Git::Reflog reflog = repo.reflogForRef(repo.head());
-                for (size_t i=0; revs.size()<RevCountDefault; i++) {
-                    const git_reflog_entry*const entry = reflog[i];
-                    if (!entry) break; // End of reflog
-                    
-                    try {
-                        Rev rev;
-                        (Git::Rev&)rev = repo.reflogRevForCheckoutEntry(entry);
-                        // Ignore non-ref reflog entries
-                        if (!rev.ref) continue;
-                        const auto [_, inserted] = unique.insert(rev);
-                        if (inserted) revs.emplace_back(rev);
-                        
-                    // Ignore errors -- refs mentioned in the reflog may have been deleted,
-                    // which will throw when we try to lookup
-                    } catch (const std::exception& e) {}
-                }
-            
-            } else {
-                // Unique the supplied revs, because our code assumes a 1:1 mapping between Revs and RevColumns
-                std::set<Rev> unique;
-                for (const std::string& revName : args.run.revs) {
-                    Rev rev;
-                    try {
-                        rev = _RevLookup(repo, revName);
-                    } catch (...) {
-                        throw Toastbox::RuntimeError("invalid rev: %s", revName.c_str());
-                    }
-                    
-                    if (unique.find(rev) == unique.end()) {
-                        revs.push_back(rev);
-                        unique.insert(rev);
-                    }
+                if (unique.find(rev) == unique.end()) {
+                    revs.push_back(rev);
+                    unique.insert(rev);
                 }
             }
         }
         
         auto app = std::make_shared<App>(repo, revs);
         app->run();
+        Trace::Stop();
     
     } catch (const std::exception& e) {
         fprintf(stderr, "Error: %s\n", e.what());
+        
+        // Write the trace even if we failed, since that's when it's most useful
+        try {
+            Trace::Stop();
+        } catch (const std::exception& e) {
+            fprintf(stderr, "Error: %s\n", e.what());
+        }
         return 1;
     }
     
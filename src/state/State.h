@@ -1,18 +1,38 @@
 #pragma once
 #include <set>
 #include <fstream>
+#include <sstream>
+#include <chrono>
 #include <sys/stat.h>
 #include <sys/file.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include "lib/toastbox/RuntimeError.h"
 #include "lib/toastbox/FileDescriptor.h"
 #include "lib/toastbox/FDStream.h"
 #include "lib/nlohmann/json.h"
 #include "git/Git.h"
 #include "git/Modify.h"
+#include "git/MergeCache.h"
+#include "git/IdSet.h"
+#include "git/Conflict.h"
 #include "Version.h"
 #include "History.h"
 
+// Git::IdSet serialization, as an array of id strings
+template <>
+struct nlohmann::adl_serializer<Git::IdSet> {
+    static void to_json(nlohmann::json& j, const Git::IdSet& x) {
+        j = nlohmann::json::array();
+        for (const Git::Id& id : x.sorted()) j.push_back(Git::StringFromId(id));
+    }
+    
+    static void from_json(const nlohmann::json& j, Git::IdSet& x) {
+        x.clear();
+        for (const auto& id : j) x.insert(Git::IdFromString(id.get<std::string>()));
+    }
+};
+
 namespace State {
 
 struct Ref : std::string {
@@ -102,8 +122,8 @@ struct HistoryRefState {
     HistoryRefState(const Git::Ref& ref) : refState(ref) {}
     
     RefState refState;
-    std::set<Commit> selection;
-    std::set<Commit> selectionPrev;
+    Git::IdSet selection;
+    Git::IdSet selectionPrev;
     
     bool operator <(const HistoryRefState& x) const {
         if (refState != x.refState) return refState < x.refState;
@@ -506,6 +526,7 @@ public:
     }
     
     void write() {
+        const Trace::Span trace("RepoState::write");
         Toastbox::FDStreamInOut versionLockFile = State::AcquireVersionLock(_rootDir, false);
         
         // Read existing state
@@ -578,6 +599,151 @@ public:
     Git::Repo repo() const {
         return _repo;
     }
+    
+    // dir(): the directory that holds the repository's state
+    _Path dir() const {
+        return _repoStateDir;
+    }
+};
+
+// MARK: - ResolutionCache
+// ResolutionCache: remembers how conflicts were resolved, so that encountering the same
+// conflict again (eg after undo+redo) can reuse the resolution instead of prompting
+//
+// Resolutions are keyed by a hash of the conflict's hunks, so they apply regardless of
+// which commits or which file produced the conflict. Each resolution is stored in its
+// own file, which is written atomically and never modified, so no locking is needed.
+// Resolutions that haven't been used for _ExpireDays are deleted.
+class ResolutionCache {
+public:
+    // Resolution: the resolved file content, or nullopt if the file was deleted
+    using Resolution = std::optional<std::string>;
+    
+    ResolutionCache() {}
+    // Expired resolutions are pruned here, so a ResolutionCache should be created once
+    // per session rather than per operation
+    ResolutionCache(std::filesystem::path rootDir) : _dir(rootDir / "Resolutions") {
+        _prune();
+    }
+    
+    std::optional<Resolution> get(const Git::Conflict& fc) const {
+        const _Path path = _dir / _Key(fc);
+        std::ifstream f(path, std::ios::binary);
+        if (!f) return std::nullopt;
+        
+        std::stringstream ss;
+        ss << f.rdbuf();
+        const std::string str = ss.str();
+        if (str.empty()) return std::nullopt;
+        
+        // Mark the resolution as recently used, so that it isn't pruned
+        std::error_code ec;
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+        
+        switch (str[0]) {
+        case _TagFile:      return Resolution(str.substr(1));
+        case _TagNoFile:    return Resolution(std::nullopt);
+        default:            return std::nullopt;
+        }
+    }
+    
+    // set(): remembers `res` as the resolution of `fc`
+    // The cache is only a convenience, so failing to write it is ignored rather than
+    // failing the operation whose conflicts were resolved.
+    void set(const Git::Conflict& fc, const Resolution& res) {
+        _Path pathTmp;
+        try {
+            std::filesystem::create_directories(_dir);
+            const _Path path = _dir / _Key(fc);
+            pathTmp = _Path(path).concat(".tmp" + std::to_string(getpid()));
+            {
+                std::ofstream f(pathTmp, std::ios::binary);
+                f.exceptions(std::ios::failbit | std::ios::badbit);
+                f << (res ? _TagFile : _TagNoFile);
+                if (res) f << *res;
+            }
+            std::filesystem::rename(pathTmp, path);
+        
+        } catch (...) {
+            std::error_code ec;
+            if (!pathTmp.empty()) std::filesystem::remove(pathTmp, ec);
+        }
+    }
+    
+private:
+    using _Path = std::filesystem::path;
+    
+    static constexpr char _TagFile = 'f';
+    static constexpr char _TagNoFile = '-';
+    static constexpr int _ExpireDays = 60;
+    
+    // _Key(): returns the hash of the normalized hunks of `fc`
+    // The sides of each conflict hunk are ordered by their content rather than by
+    // ours/theirs, so that a conflict and its mirror image share a resolution.
+    static std::string _Key(const Git::Conflict& fc) {
+        std::string str = (fc.type==Git::Conflict::Type::File ? "file\n" : "submodule\n");
+        auto linesWrite = [&] (char tag, const std::vector<std::string_view>& lines) {
+            str += tag + std::to_string(lines.size()) + "\n";
+            for (std::string_view line : lines) {
+                str += line;
+                str += '\n';
+            }
+        };
+        
+        for (const Git::Conflict::Hunk& hunk : fc.hunks) {
+            switch (hunk.type) {
+            case Git::Conflict::Hunk::Type::Normal:
+                linesWrite('n', hunk.normal.lines);
+                break;
+            case Git::Conflict::Hunk::Type::Conflict: {
+                const auto& a = hunk.conflict.linesOurs;
+                const auto& b = hunk.conflict.linesTheirs;
+                const bool swap = std::lexicographical_compare(b.begin(), b.end(), a.begin(), a.end());
+                linesWrite('c', (swap ? b : a));
+                linesWrite('c', (swap ? a : b));
+                break;
+            }
+            default:
+                abort();
+            }
+        }
+        
+        Git::Id id;
+        int ir = git_odb_hash(&id, str.data(), str.size(), GIT_OBJECT_BLOB);
+        if (ir) throw Git::Error(ir, "git_odb_hash failed");
+        return Git::StringFromId(id);
+    }
+    
+    void _prune() {
+        namespace fs = std::filesystem;
+        const auto expire = fs::file_time_type::clock::now() - std::chrono::hours(24*_ExpireDays);
+        std::error_code ec;
+        for (const fs::directory_entry& e : fs::directory_iterator(_dir, ec)) {
+            if (e.last_write_time(ec)<expire && !ec) fs::remove(e.path(), ec);
+        }
+    }
+    
+    _Path _dir;
 };
 
+// MARK: - MergeCache
+// A Git::MergeCache is persisted per repository, since merges depend on the
+// repository's attributes and configuration (see Git::MergeCache)
+inline std::filesystem::path _MergeCachePath(const RepoState& repoState) {
+    return repoState.dir() / "MergeCache";
+}
+
+// MergeCacheRead(): adds the entries persisted for `repoState`'s repository to `cache`
+inline void MergeCacheRead(const RepoState& repoState, Git::MergeCache& cache) {
+    cache.read(_MergeCachePath(repoState));
+}
+
+// MergeCacheWrite(): persists `cache` for `repoState`'s repository
+// The cache is only an optimization, so failing to write it is ignored.
+inline void MergeCacheWrite(const RepoState& repoState, Git::MergeCache& cache) {
+    try {
+        cache.write(_MergeCachePath(repoState));
+    } catch (...) {}
+}
+
 } // namespace State
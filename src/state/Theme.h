@@ -4,9 +4,15 @@
 
 namespace State {
 
-Theme ThemeRead() {
+static void ThemeWrite(Theme theme) {
     State state(StateDir());
-    Theme theme = state.theme();
+    state.theme(theme);
+    state.write();
+}
+
+// ThemeResolve(): returns `theme`, or if it's Theme::None, the theme that matches
+// the terminal's background color
+Theme ThemeResolve(Theme theme) {
     if (theme != Theme::None) return theme;
     
     bool write = false;
@@ -29,17 +35,18 @@ Theme ThemeRead() {
     case Terminal::Background::Light:   theme = Theme::Light; break;
     }
     
-    if (write) {
-        state.theme(theme);
-        state.write();
-    }
+    if (write) ThemeWrite(theme);
     return theme;
 }
 
-static void ThemeWrite(Theme theme) {
-    State state(StateDir());
-    state.theme(theme);
-    state.write();
+Theme ThemeRead() {
+    Theme theme = Theme::None;
+    // Don't hold the state lock while ThemeResolve() waits on the terminal
+    {
+        State state(StateDir());
+        theme = state.theme();
+    }
+    return ThemeResolve(theme);
 }
 
 }
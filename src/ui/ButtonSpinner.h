@@ -55,6 +55,12 @@ public:
     
 //    operator bool() const { return (bool)_s.button; }
     
+    // AnimationFrame(): returns frame `idx` (modulo the frame count) of our animation,
+    // for views that want to display the same spinner
+    static const char* AnimationFrame(size_t idx) {
+        return _Animation[idx % std::size(_Animation)];
+    }
+    
 private:
 //    static constexpr const char* _Animation[] = { "⢿","⣻","⣽","⣾","⣷","⣯","⣟","⡿" };
 //    static constexpr const char* _Animation[] = { "⠋","⠙","⠹","⠸","⠼","⠴","⠦","⠧","⠇","⠏" };
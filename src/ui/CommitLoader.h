@@ -0,0 +1,191 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "git/Git.h"
+#include "git/FirstParentPager.h"
+#include "CommitPanel.h"
+
+namespace UI {
+
+// CommitLoader: loads the commits displayed by a RevColumn on a background thread
+//
+// A load walks the first-parent chain of a head commit, starting at a given depth,
+// and derives each commit's CommitPanel metadata as it goes, so that creating the
+// CommitPanels on the UI thread afterwards is cheap. The ids of the loaded commits
+// are handed back in batches via take().
+//
+// The worker thread uses its own repository handle, since libgit2 handles can't be
+// shared between threads, and only ever hands commit ids back to the UI thread.
+class CommitLoader {
+public:
+    struct Result {
+        std::vector<Git::Id> ids;   // Ids loaded since the previous take()
+        size_t depth = 0;           // Depth of the load's first commit; can be less than the requested
+                                    // depth if the history isn't that deep
+        bool done = false;          // Whether the load is complete
+        bool end = false;           // Whether the load reached the root commit
+    };
+    
+    CommitLoader(const Git::Repo& repo) : _repo(repo.reopen()) {
+        _thread = std::thread([=] { _threadRun(); });
+    }
+    
+    ~CommitLoader() {
+        {
+            auto lock = std::unique_lock(_s.lock);
+            _s.stop = true;
+        }
+        _s.signal.notify_all();
+        _thread.join();
+    }
+    
+    CommitLoader(const CommitLoader&) = delete;
+    CommitLoader& operator=(const CommitLoader&) = delete;
+    
+    // load(): starts loading up to `count` commits, starting `depth` first-parents
+    // below `head`. Replaces any load that's in progress.
+    void load(const Git::Commit& head, size_t depth, size_t count) {
+        assert(head);
+        {
+            auto lock = std::unique_lock(_s.lock);
+            _s.gen++;
+            _s.request = _Request{
+                .head = head.id(),
+                .depth = depth,
+                .count = count,
+            };
+            _s.result = {};
+            _s.error.clear();
+        }
+        _s.signal.notify_all();
+        _active = true;
+    }
+    
+    // loading(): whether a load is in progress, or has results that haven't been taken yet
+    bool loading() const { return _active; }
+    
+    // take(): returns the results of the current load since the previous take()
+    // Throws if the load failed.
+    Result take() {
+        auto lock = std::unique_lock(_s.lock);
+        Result r = std::move(_s.result);
+        _s.result = {
+            .depth = r.depth,
+            .done = r.done,
+            .end = r.end,
+        };
+        
+        if (r.done) _active = false;
+        if (!_s.error.empty()) {
+            _active = false;
+            throw Toastbox::RuntimeError("failed to load commits: %s", _s.error.c_str());
+        }
+        return r;
+    }
+    
+    // wait(): waits until the current load is complete, or `deadline` passes
+    void wait(std::chrono::steady_clock::time_point deadline) {
+        auto lock = std::unique_lock(_s.lock);
+        _s.signal.wait_until(lock, deadline, [&] { return !_s.request && _s.result.done; });
+    }
+    
+private:
+    struct _Request {
+        Git::Id head;
+        size_t depth = 0;
+        size_t count = 0;
+    };
+    
+    void _threadRun() {
+        Trace::ThreadName("commit loader");
+        for (;;) {
+            _Request req;
+            uint64_t gen = 0;
+            {
+                auto lock = std::unique_lock(_s.lock);
+                _s.signal.wait(lock, [&] { return _s.stop || _s.request; });
+                if (_s.stop) return;
+                req = *_s.request;
+                gen = _s.gen;
+                _s.request = std::nullopt;
+            }
+            
+            try {
+                _load(req, gen);
+            
+            } catch (const std::exception& e) {
+                auto lock = std::unique_lock(_s.lock);
+                if (gen == _s.gen) {
+                    _s.error = e.what();
+                    _s.result.done = true;
+                }
+            }
+            _s.signal.notify_all();
+        }
+    }
+    
+    // _publish(): runs `fn` with our lock held, if `gen` is still the current load;
+    // returns false if `gen` has been superseded and should be abandoned
+    template <typename T_Fn>
+    bool _publish(uint64_t gen, T_Fn fn) {
+        {
+            auto lock = std::unique_lock(_s.lock);
+            if (gen!=_s.gen || _s.stop) return false;
+            fn();
+        }
+        _s.signal.notify_all();
+        return true;
+    }
+    
+    // _load(): performs a load on the worker thread
+    void _load(const _Request& req, uint64_t gen) {
+        const Trace::Span trace("CommitLoader::load");
+        // Our pager persists between loads of the same head, so that scrolling only
+        // needs to walk the parts of the history that it hasn't already seen
+        if (!_pager || !git_oid_equal(&_pager.head().id(), &req.head)) {
+            _pager = Git::FirstParentPager(_repo.commitLookup(req.head));
+        }
+        
+        // Back up to the last commit if the history isn't as deep as requested
+        size_t depth = req.depth;
+        Git::Commit commit = _pager.at(depth);
+        while (!commit && depth) commit = _pager.at(--depth);
+        
+        if (!_publish(gen, [&] { _s.result.depth = depth; })) return;
+        
+        for (size_t i=0; i<req.count && commit; i++) {
+            CommitPanel::InfoPrefetch(commit);
+            if (!_publish(gen, [&] { _s.result.ids.push_back(commit.id()); })) return;
+            commit = commit.parent();
+        }
+        
+        _publish(gen, [&] {
+            _s.result.done = true;
+            _s.result.end = !commit;
+        });
+    }
+    
+    // Worker thread only
+    Git::Repo _repo;
+    Git::FirstParentPager _pager;
+    
+    // Shared between threads; protected by `lock`
+    struct {
+        std::mutex lock;
+        std::condition_variable signal;
+        uint64_t gen = 0;
+        std::optional<_Request> request;
+        Result result;
+        std::string error;
+        bool stop = false;
+    } _s;
+    
+    // UI thread only
+    bool _active = false;
+    std::thread _thread;
+};
+
+using CommitLoaderPtr = std::unique_ptr<CommitLoader>;
+
+} // namespace UI
@@ -1,5 +1,8 @@
 #pragma once
 #include <optional>
+#include <mutex>
+#include <list>
+#include <unordered_map>
 #include "git/Git.h"
 #include "Panel.h"
 #include "Color.h"
@@ -125,23 +128,93 @@ public:
     template <typename T> bool commit(const T& x) {
         if (!_set(_commit, x)) return false;
         
-        const Git::Signature sig = _commit.author();
-        _id->text(Git::DisplayStringForId(_commit.id(), _CommitIdWidth));
-        _time->text(Git::ShortStringForTime(Git::TimeForGitTime(sig.time())));
-        _author->text(sig.name());
-        _message->text(_commit.message());
+        const _InfoPtr info = _InfoGet(_commit);
+        _id->text(info->id);
+        _time->text(info->time);
+        _author->text(info->author);
+        _message->text(info->message);
         
-        _mergeSymbol->visible(_commit.isMerge());
+        _mergeSymbol->visible(info->merge);
         return true;
     }
     
     const auto& header() const { return _header; }
     template <typename T> void header(const T& x) { _set(_header, x); }
     
+    // InfoPrefetch(): derives the displayed metadata for `commit` ahead of time, so that
+    // creating a CommitPanel for it later is cheap. Safe to call from any thread.
+    static void InfoPrefetch(const Git::Commit& commit) {
+        _InfoGet(commit);
+    }
+    
 private:
     static constexpr int _CommitIdWidth = 7;
     static constexpr int _MessageLineCountMax = 2;
     static constexpr int _TextInset = 2;
+    // Upper bound on the width of our message; only used to decide how much of a
+    // commit's message needs to be kept around, so it just needs to be generous
+    static constexpr size_t _MessageWidthMax = 256;
+    static constexpr size_t _InfoCacheCap = 4096;
+    
+    // _Info: the displayed metadata for a commit, derived once per commit id
+    struct _Info {
+        std::string id;
+        std::string time;
+        std::string author;
+        std::string message; // Only the part that fits in _MessageLineCountMax lines
+        bool merge = false;
+    };
+    
+    using _InfoPtr = std::shared_ptr<const _Info>;
+    
+    // _InfoGet(): returns the _Info for `commit`, from a cache that's shared by all
+    // CommitPanels, so that reloading a column doesn't redo this work for commits
+    // that have already been displayed. Since commits are immutable, entries never
+    // need to be invalidated, only evicted.
+    static _InfoPtr _InfoGet(const Git::Commit& commit) {
+        using _Entry = std::pair<Git::Id,_InfoPtr>;
+        static std::mutex Lock;
+        static std::list<_Entry> Cache; // Most recently used first
+        static std::unordered_map<Git::Id,std::list<_Entry>::iterator,Git::IdHash,Git::IdEqual> Map;
+        
+        const Git::Id& id = commit.id();
+        {
+            auto lock = std::unique_lock(Lock);
+            auto find = Map.find(id);
+            if (find != Map.end()) {
+                Cache.splice(Cache.begin(), Cache, find->second);
+                return find->second->second;
+            }
+        }
+        
+        const git_signature* sig = git_commit_author(*commit);
+        const LineWrap::Options opts = {
+            .width = _MessageWidthMax,
+            .height = (size_t)_MessageLineCountMax,
+        };
+        
+        const _InfoPtr info = std::make_shared<_Info>(_Info{
+            .id = Git::DisplayStringForId(id, _CommitIdWidth),
+            .time = (sig ? Git::ShortStringForTime(Git::TimeForGitTime(sig->when)) : ""),
+            .author = (sig ? sig->name : ""),
+            // Use the raw message rather than Commit::message(), to avoid copying the
+            // entire message when we only need its beginning
+            .message = LineWrap::Prefix(opts, git_commit_message(*commit)),
+            .merge = commit.isMerge(),
+        });
+        
+        auto lock = std::unique_lock(Lock);
+        // Another thread may have beaten us to it
+        if (Map.find(id) == Map.end()) {
+            Cache.emplace_front(id, info);
+            Map.emplace(id, Cache.begin());
+            if (Cache.size() > _InfoCacheCap) {
+                Map.erase(Cache.back().first);
+                Cache.pop_back();
+            }
+        }
+        return info;
+    }
     
     Git::Commit _commit;
     LabelPtr _header        = subviewCreate<Label>();
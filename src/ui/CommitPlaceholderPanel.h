@@ -0,0 +1,43 @@
+#pragma once
+#include "Panel.h"
+#include "Label.h"
+#include "ButtonSpinner.h"
+
+namespace UI {
+
+// CommitPlaceholderPanel: stands in for a CommitPanel while its commit is loading
+class CommitPlaceholderPanel : public Panel {
+public:
+    static constexpr int Height = 3;
+    
+    CommitPlaceholderPanel() {
+        borderColor(colors().normal);
+        
+        _label->align(Align::Center);
+        _label->textAttr(colors().dimmed);
+        animate();
+    }
+    
+    Size sizeIntrinsic(Size constraint) override {
+        return {constraint.x, Height};
+    }
+    
+    using Panel::layout;
+    void layout() override {
+        const Size s = size();
+        _label->frame({{1, s.y/2}, {s.x-2, 1}});
+    }
+    
+    void animate() {
+        _label->text(ButtonSpinner::AnimationFrame(_frame));
+        _frame++;
+    }
+    
+private:
+    LabelPtr _label = subviewCreate<Label>();
+    size_t _frame = 0;
+};
+
+using CommitPlaceholderPanelPtr = std::shared_ptr<CommitPlaceholderPanel>;
+
+} // namespace UI
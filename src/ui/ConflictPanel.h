@@ -24,6 +24,15 @@ public:
         const Git::Conflict& fc, size_t hunkIdx) :
         _layout(layout), _fileConflict(fc), _hunkIdx(hunkIdx) {
         
+        for (bool left : {true, false}) {
+            _Column& col = _columnGet(left);
+            col.hunkStarts.reserve(fc.hunks.size()+1);
+            col.hunkStarts.push_back(0);
+            for (const Git::Conflict::Hunk& hunk : fc.hunks) {
+                col.hunkStarts.push_back(col.hunkStarts.back() + _hunkLinesGet(hunk, left).size());
+            }
+        }
+        
         borderColor(colors().error);
         
         _title->inhibitErase(true); // Title overlaps border, so don't erase
@@ -182,6 +191,20 @@ public:
         if (enabled()) {
             if (ev.type == Event::Type::KeyEscape) {
                 _doneAction(Result::Cancel);
+            
+            // Scroll wheel: scroll the side that's under the mouse
+            } else if (const int dir = ev.mouseScroll()) {
+                const bool left = (ev.mouse.origin.x < _SeparatorX(bounds()));
+                _scrollBy(left, dir*_ScrollWheelLines);
+            
+            // Arrow/page keys: scroll both sides
+            } else if (ev.type==Event::Type::KeyUp       || ev.type==Event::Type::KeyDown ||
+                       ev.type==Event::Type::KeyPageUp   || ev.type==Event::Type::KeyPageDown) {
+                const bool up = (ev.type==Event::Type::KeyUp || ev.type==Event::Type::KeyPageUp);
+                const bool page = (ev.type==Event::Type::KeyPageUp || ev.type==Event::Type::KeyPageDown);
+                const ssize_t count = (page ? std::max(1, _ContentRectLeft(bounds()).h()-1) : 1);
+                _scrollBy(true, (up ? -count : count));
+                _scrollBy(false, (up ? -count : count));
             }
         }
         return true;
@@ -192,10 +215,17 @@ public:
     
 private:
     static constexpr int _TitleInsetX = 2;
+    static constexpr int _ScrollWheelLines = 3;
     static constexpr Size _Inset = {3,1};
     static constexpr int _ContentInsetTop = 1;
     static constexpr int _ContentInsetBottom = 8;
     
+    // _Column: the lines of one side of the panel (the lines of every hunk, for that side)
+    struct _Column {
+        std::vector<size_t> hunkStarts; // Index of each hunk's first line, plus the total line count
+        ssize_t scroll = 0;             // Lines scrolled relative to the initial position
+    };
+    
     static int _SeparatorX(const Rect& bounds) {
         return bounds.w()/2;
     }
@@ -218,7 +248,7 @@ private:
         };
     }
     
-    const std::vector<std::string>& _hunkLinesGet(const Git::Conflict::Hunk& hunk, bool left) const {
+    const std::vector<std::string_view>& _hunkLinesGet(const Git::Conflict::Hunk& hunk, bool left) const {
         switch (hunk.type) {
         case Git::Conflict::Hunk::Type::Normal:
             return hunk.normal.lines;
@@ -234,18 +264,60 @@ private:
         }
     }
     
-    int _maxLinesAboveConflict(bool left) const {
-        const int h = bounds().h(); // No need to return values over our height
-        const auto& hunks = _fileConflict.hunks;
-        auto hunkRend = std::rend(hunks);
-        int count = 0;
-        for (auto hunkIter=std::make_reverse_iterator(std::begin(hunks)+_hunkIdx); hunkIter!=hunkRend && count<h; hunkIter++) {
-            const std::vector<std::string>& lines = _hunkLinesGet(*hunkIter, left);
-            for (auto it=lines.rbegin(); it!=lines.rend() && count<h; it++) {
-                count++;
-            }
-        }
-        return count;
+    _Column& _columnGet(bool left) { return _columns[left ? 0 : 1]; }
+    const _Column& _columnGet(bool left) const { return _columns[left ? 0 : 1]; }
+    
+    // _line(): returns line `idx` of the given side, by finding its hunk via the
+    // column's hunkStarts, so that we never need to walk the lines before it
+    std::string_view _line(bool left, size_t idx) const {
+        const _Column& col = _columnGet(left);
+        const auto it = std::upper_bound(col.hunkStarts.begin(), col.hunkStarts.end(), idx);
+        assert(it!=col.hunkStarts.begin() && it!=col.hunkStarts.end());
+        const size_t hunkIdx = (it-col.hunkStarts.begin())-1;
+        return _hunkLinesGet(_fileConflict.hunks[hunkIdx], left)[idx-col.hunkStarts[hunkIdx]];
+    }
+    
+    // _rowCount(): returns the number of rows in the given side: its lines, plus a
+    // placeholder row if the main conflict section is empty
+    size_t _rowCount(bool left) const {
+        const _Column& col = _columnGet(left);
+        const bool placeholder = (col.hunkStarts[_hunkIdx] == col.hunkStarts[_hunkIdx+1]);
+        return col.hunkStarts.back() + placeholder;
+    }
+    
+    // _rowTopInitial(): returns the row displayed at the top of the given side before
+    // it's scrolled, which centers the main conflict section vertically, but aligns the
+    // two sides' main conflict sections if there isn't enough context above either
+    ssize_t _rowTopInitial(bool left, int height) const {
+        const size_t mainStartLeft = _columnGet(true).hunkStarts[_hunkIdx];
+        const size_t mainStartRight = _columnGet(false).hunkStarts[_hunkIdx];
+        const int maxLinesAboveConflict = (int)std::min({mainStartLeft, mainStartRight, (size_t)std::max(0, height)});
+        
+        const _Column& col = _columnGet(left);
+        const size_t mainStart = col.hunkStarts[_hunkIdx];
+        const int mainLen = (int)std::min(col.hunkStarts[_hunkIdx+1]-mainStart, (size_t)height);
+        return (ssize_t)mainStart - std::min(maxLinesAboveConflict, std::max(0, (height-mainLen)/2));
+    }
+    
+    // _rowTop(): returns the row displayed at the top of the given side
+    // The side can't be scrolled past its first row, or such that its last row is
+    // above the bottom of `height`.
+    size_t _rowTop(bool left, int height) const {
+        const ssize_t initial = _rowTopInitial(left, height);
+        const ssize_t max = std::max(initial, (ssize_t)_rowCount(left)-height);
+        return (size_t)std::clamp(initial+_columnGet(left).scroll, (ssize_t)0, std::max((ssize_t)0, max));
+    }
+    
+    // _scrollBy(): scrolls the given side by `delta` lines
+    void _scrollBy(bool left, ssize_t delta) {
+        const int height = _ContentRectLeft(bounds()).h();
+        _Column& col = _columnGet(left);
+        const size_t topPrev = _rowTop(left, height);
+        col.scroll += delta;
+        // Clamp the scroll position, so that scrolling past the ends doesn't accumulate
+        const size_t top = _rowTop(left, height);
+        col.scroll = (ssize_t)top - _rowTopInitial(left, height);
+        if (top != topPrev) drawNeeded(true);
     }
     
     // _ContentTextFilter(): filters non-printable ascii characters, and replaces tabs with spaces
@@ -352,75 +424,54 @@ private:
 //        }
     }
     
+    // _contentTextDraw(): draws the rows of the given side that are visible in `rect`
+    // Only the visible rows are visited, so the cost doesn't depend on the conflict's size.
     void _contentTextDraw(const Rect& rect, bool left) {
-        const auto& hunks = _fileConflict.hunks;
-        auto hunkEnd = std::end(hunks);
-        auto hunkRend = std::rend(hunks);
-        
-        auto& mainConflictLines = _hunkLinesGet(hunks[_hunkIdx], left);
-        const int maxLinesAboveConflict = std::min(_maxLinesAboveConflict(true), _maxLinesAboveConflict(false));
-        const int mainConflictStartY = rect.t() + std::min(maxLinesAboveConflict, std::max(0, (rect.h()-(int)mainConflictLines.size())/2));
-//        const int mainConflictStartY = Inset.y + std::max(0, (h-(int)mainConflictLines.size())/2);
-        
-        // Draw main conflict section, and lines beneath it
-        {
-            bool main = true;
-            int offY = mainConflictStartY;
-            for (auto hunkIter=std::begin(hunks)+_hunkIdx; hunkIter!=hunkEnd && offY<rect.b(); hunkIter++) {
-                const std::vector<std::string>& lines = _hunkLinesGet(*hunkIter, left);
-                const Attr color = attr(main ? colors().conflictTextMain : colors().conflictTextDim);
-                if (!main || !lines.empty()) {
-                    for (auto it=lines.begin(); it!=lines.end() && offY<rect.b(); it++) {
-                        const std::string& line = *it;
-                        // Draw highlighted-text background
-                        if (main) drawLineHoriz({rect.l()-1, offY}, rect.w()+2, ' ');
-                        _contentTextDraw({rect.l(), offY}, rect.w(), line.c_str());
-                        offY++;
-                    }
+        const _Column& col = _columnGet(left);
+        const size_t mainStart = col.hunkStarts[_hunkIdx];
+        const size_t mainLen = col.hunkStarts[_hunkIdx+1]-mainStart;
+        // If the main conflict section is empty, it occupies a placeholder row
+        const bool placeholder = !mainLen;
+        const size_t mainEnd = mainStart + (placeholder ? 1 : mainLen);
+        const size_t rowCount = _rowCount(left);
+        const size_t top = _rowTop(left, rect.h());
+        
+        for (int y=0; y<rect.h() && top+y<rowCount; y++) {
+            const size_t row = top+y;
+            const int offY = rect.t()+y;
+            const bool main = (row>=mainStart && row<mainEnd);
+            const Attr color = attr(main ? colors().conflictTextMain : colors().conflictTextDim);
+        
+            if (main && placeholder) {
+                // This is the main conflict region, and it's empty.
+                // Draw placeholder text
+                drawLineHoriz({rect.l(), offY}, rect.w());
+                constexpr const char NoFile[]   = " no file ";
+                constexpr const char Empty[]    = " empty ";
+                
+                // The file is considered deleted if the total number of lines==0. (Therefore
+                // an empty but existing file would have 1 line containing an empty string.)
+                // So if our Conflict has one hunk and that hunk has zero lines, then it's
+                // a non-existent file.
+                const char* text = nullptr;
+                size_t textLen = 0;
                 
+                const bool noFile = _fileConflict.noFile(Git::Conflict::Side::Ours) || _fileConflict.noFile(Git::Conflict::Side::Theirs);
+                if (noFile) {
+                    text = NoFile;
+                    textLen = std::size(NoFile)-1;
                 } else {
-                    // This is the main conflict region, and it's empty.
-                    // Draw placeholder text
-                    drawLineHoriz({rect.l(), offY}, rect.w());
-                    constexpr const char NoFile[]   = " no file ";
-                    constexpr const char Empty[]    = " empty ";
-                    
-                    // The file is considered deleted if the total number of lines==0. (Therefore
-                    // an empty but existing file would have 1 line containing an empty string.)
-                    // So if our Conflict has one hunk and that hunk has zero lines, then it's
-                    // a non-existent file.
-                    const char* text = nullptr;
-                    size_t textLen = 0;
-                    
-                    const bool noFile = _fileConflict.noFile(Git::Conflict::Side::Ours) || _fileConflict.noFile(Git::Conflict::Side::Theirs);
-                    if (noFile) {
-                        text = NoFile;
-                        textLen = std::size(NoFile)-1;
-                    } else {
-                        text = Empty;
-                        textLen = std::size(Empty)-1;
-                    }
-                    
-                    drawText({rect.l()+(rect.w()-((int)textLen))/2, offY}, text);
-                    offY++;
+                    text = Empty;
+                    textLen = std::size(Empty)-1;
                 }
                 
-                main = false;
+                drawText({rect.l()+(rect.w()-((int)textLen))/2, offY}, text);
+                continue;
             }
-        }
         
-        // Draw lines above the main conflict section
-        {
-            const Attr color = attr(colors().conflictTextDim);
-            int offY = mainConflictStartY-1;
-            for (auto hunkIter=std::make_reverse_iterator(std::begin(hunks)+_hunkIdx); hunkIter!=hunkRend && offY>=rect.t(); hunkIter++) {
-                const std::vector<std::string>& lines = _hunkLinesGet(*hunkIter, left);
-                for (auto it=lines.rbegin(); it!=lines.rend() && offY>=rect.t(); it++) {
-                    const std::string& line = *it;
-                    _contentTextDraw({rect.l(), offY}, rect.w(), line.c_str());
-                    offY--;
-                }
-            }
+            // Draw highlighted-text background
+            if (main) drawLineHoriz({rect.l()-1, offY}, rect.w()+2, ' ');
+            _contentTextDraw({rect.l(), offY}, rect.w(), _line(left, (placeholder && row>mainStart ? row-1 : row)));
         }
     }
     
@@ -443,6 +494,7 @@ private:
     const Layout _layout = Layout::LeftOurs;
     const Git::Conflict& _fileConflict;
     const size_t _hunkIdx = 0;
+    _Column _columns[2]; // Left, right
     
     LabelPtr _title = subviewCreate<Label>();
     LabelPtr _titleFilePath = subviewCreate<Label>();
@@ -88,4 +88,62 @@ inline std::vector<std::string> Wrap(const Options& opts, std::string_view str)
     return lines;
 }
 
+// Prefix(): returns a prefix of `str` that Wrap() turns into the same lines as `str`,
+// for any width <= opts.width and height <= opts.height.
+// This lets callers that only ever display a few lines of a potentially huge string
+// (eg a commit message) hold on to just the part that can actually be displayed.
+// Words are re-joined with single spaces, which doesn't affect the output of Wrap()
+// since it splits lines on whitespace anyway.
+inline std::string Prefix(const Options& opts, std::string_view str) {
+    if (opts.width==SIZE_MAX || opts.height==SIZE_MAX) return std::string(str);
+    
+    // Wrapping `height` lines of a single input line consumes at most `width*height`
+    // characters, plus the beginning of the next word (which is added to the last line
+    // if it doesn't fit). So keeping `width*(height+1)+1` characters of each input line
+    // guarantees that a word that would've been split still gets split.
+    const size_t lenMax = opts.width*(opts.height+1) + 1;
+    // Same set of characters as `std::istream >> std::string` in the classic locale
+    const auto space = [] (char c) {
+        return c==' ' || c=='\t' || c=='\n' || c=='\v' || c=='\f' || c=='\r';
+    };
+    
+    std::string r;
+    size_t lineCount = 0;
+    size_t off = 0;
+    while (lineCount<opts.height && off<str.size()) {
+        const size_t end = std::min(str.find('\n', off), str.size());
+        const std::string_view line = str.substr(off, end-off);
+        off = end+1;
+        if (!opts.allowEmptyLines && line.empty()) continue;
+        
+        std::string l;
+        size_t len = 0;
+        for (size_t i=0; i<line.size() && len<lenMax;) {
+            // Skip whitespace
+            while (i<line.size() && space(line[i])) i++;
+            if (i == line.size()) break;
+            
+            if (!l.empty()) {
+                l += ' ';
+                len++;
+            }
+            
+            // Copy the word, stopping at a UTF-8 character boundary if we run out of room
+            for (; i<line.size() && !space(line[i]); i++) {
+                const bool lead = (((uint8_t)line[i] & 0xC0) != 0x80);
+                if (lead && len==lenMax) break;
+                l += line[i];
+                if (lead) len++;
+            }
+        }
+        
+        // Lines that only contain whitespace still produce an (empty) output line,
+        // so they need to stay non-empty
+        r += (!l.empty() ? l : " ");
+        r += '\n';
+        lineCount++;
+    }
+    return r;
+}
+
 } // namespace UI::LineWrap
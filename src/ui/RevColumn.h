@@ -2,6 +2,8 @@
 #include "git/Git.h"
 #include "Panel.h"
 #include "CommitPanel.h"
+#include "CommitPlaceholderPanel.h"
+#include "CommitLoader.h"
 #include "Color.h"
 #include "UTF8.h"
 #include "Button.h"
@@ -49,6 +51,80 @@ public:
         // Set our column name
         _nameField->value(name(false));
         
+        // Start loading the commits in our visible region
+        // Only the commits that fit on screen are loaded, starting at our scroll position,
+        // so the cost of a column doesn't depend on the length of its history. Loading
+        // happens on a background thread; loadUpdate() creates the CommitPanels as the
+        // commits arrive.
+        if (!_loader) _loader = std::make_unique<CommitLoader>(_repo);
+        
+        // If our rev now refers to a different commit, our existing panels are stale
+        // and can't be shown while we load
+        if (_loadHead != _rev.commit) _panels.clear();
+        _loadHead = _rev.commit;
+        _loadIds.clear();
+        _historyEnd = false;
+        _size = size;
+            
+        if (_rev.commit) {
+            // Load enough commits to fill our height with the smallest possible panels,
+            // plus one extra so that the commit below the last visible panel is known
+            const int height = std::max(0, size.y-_CommitsInsetY);
+            const size_t count = height/(_PanelHeightMin+_CommitSpacing) + 2;
+            _loader->load(_rev.commit, _rev.skip+_scroll, count);
+        }
+        
+        _panelsUpdate();
+    }
+        
+    // loadUpdate(): creates panels for the commits that have been loaded since the
+    // last call, and animates our placeholders; returns whether we're still loading
+    bool loadUpdate() {
+        if (!loading()) return false;
+        
+        CommitLoader::Result r;
+        try {
+            r = _loader->take();
+        } catch (...) {
+            // The load failed and is no longer in progress, so remove our placeholders
+            _panelsUpdate();
+            throw;
+        }
+        
+        _loadIds.insert(_loadIds.end(), r.ids.begin(), r.ids.end());
+        if (r.done) {
+            _historyEnd = r.end;
+            // Adopt the load's depth, which is less than our requested depth if we
+            // scrolled past the end of the history
+            _scroll = (r.depth>_rev.skip ? r.depth-_rev.skip : 0);
+        }
+        
+        _panelsUpdate();
+        for (CommitPlaceholderPanelPtr placeholder : _placeholders) {
+            placeholder->animate();
+        }
+        return loading();
+    }
+    
+    // loadWait(): waits until our load completes or `deadline` passes, and updates
+    // our panels either way
+    void loadWait(std::chrono::steady_clock::time_point deadline) {
+        if (!loading()) return;
+        _loader->wait(deadline);
+        loadUpdate();
+    }
+    
+    bool loading() const { return _loader && _loader->loading(); }
+    
+    void layout() override {
+        constexpr int UndoWidth      = 8;
+        constexpr int RedoWidth      = 8;
+        constexpr int SnapshotsWidth = 16;
+            
+        const Size s = size();
+        
+        // Show our mutability here rather than in reload(), so that changing our rev's
+        // mutability only requires a layout
         const bool readOnly = !_rev.isMutable();
         const char* readOnlyReason = _ReadOnlyReason(_rev.mutability);
         if (readOnly && readOnlyReason) {
@@ -72,53 +148,10 @@ public:
         _undoButton->visible(!readOnly);
         _redoButton->visible(!readOnly);
         _snapshotsButton->visible(!readOnly);
-        
+
 //        _redoButton->visible(false);
 //        _snapshotsButton->visible(false);
         
-        // Create our CommitPanels for each commit
-        Git::Commit commit = _rev.commit;
-        size_t skip = _rev.skip;
-        size_t i = 0;
-        int offY = _CommitsInsetY;
-        while (commit) {
-            if (!skip) {
-                CommitPanelPtr panel = (i<_panels.size() ? _panels[i] : nullptr);
-                
-                // Create the panel if it doesn't already exist, or if it does but contains the wrong commit
-                if (!panel || panel->commit()!=commit) {
-                    panel = subviewCreate<CommitPanel>();
-                    panel->commit(commit);
-                    _panels.insert(_panels.begin()+i, panel);
-                }
-                
-                const Size panelSize = panel->sizeIntrinsic({size.x, ConstraintNone});
-                const int rem = size.y-offY;
-                if (panelSize.y > rem) break;
-                
-                offY += panelSize.y + _CommitSpacing;
-                i++;
-            
-            } else {
-                skip--;
-            }
-            
-            commit = commit.parent();
-        }
-        
-        // Erase excess panels (ones that extend beyond visible region)
-        _panels.erase(_panels.begin()+i, _panels.end());
-        
-        layoutNeeded(true);
-    }
-    
-    void layout() override {
-        constexpr int UndoWidth      = 8;
-        constexpr int RedoWidth      = 8;
-        constexpr int SnapshotsWidth = 16;
-            
-        const Size s = size();
-        
         _nameField->frame({{0,_NameInsetY}, {s.x, 1}});
         _statusLine1->frame({{0,_StatusLine1InsetY}, {s.x, 1}});
         _statusLine2->frame({{0,_StatusLine2InsetY}, {s.x, 1}});
@@ -134,6 +167,12 @@ public:
             panel->frame(pf);
             offY += ps.y + _CommitSpacing;
         }
+        
+        for (CommitPlaceholderPanelPtr placeholder : _placeholders) {
+            const Size ps = placeholder->sizeIntrinsic({s.x, ConstraintNone});
+            placeholder->frame({{0,offY}, ps});
+            offY += ps.y + _CommitSpacing;
+        }
     }
     
 //    bool drawNeeded() const override {
@@ -198,6 +237,26 @@ public:
         return nullptr;
     }
     
+    // scrollBy(): scrolls the column by `delta` commits (positive values scroll
+    // towards older commits); returns whether the scroll position changed.
+    // reload() must be called afterwards to update the panels.
+    bool scrollBy(ssize_t delta) {
+        size_t scroll = (delta<0 ? _scroll-std::min(_scroll, (size_t)-delta) : _scroll+(size_t)delta);
+        // Don't scroll past the root commit if we know where it is; otherwise the
+        // load clamps our scroll position once it finds out
+        if (_historyEnd && !_loadIds.empty()) {
+            scroll = std::min(scroll, _scroll+_loadIds.size()-1);
+        }
+        return _set(_scroll, scroll);
+    }
+    
+    // commitBelow(): returns the commit that follows the last visible panel, or
+    // nullptr if the last visible panel contains the root commit
+    Git::Commit commitBelow() const {
+        if (_panels.empty()) return nullptr;
+        return _panels.back()->commit().parent();
+    }
+    
     const auto& repo() const { return _repo; }
     template <typename T> bool repo(const T& x) { return _set(_repo, x); }
     
@@ -210,6 +269,8 @@ public:
     const auto& panels() const { return _panels; }
     template <typename T> bool panels(const T& x) { return _set(_panels, x); }
     
+    const auto& scrollOffset() const { return _scroll; }
+    
     const auto& undoButton() const { return _undoButton; }
     template <typename T> bool undoButton(const T& x) { return _set(_undoButton, x); }
     
@@ -228,16 +289,67 @@ private:
     static constexpr int _ButtonsInsetY         = 1;
     static constexpr int _CommitsInsetY         = 5;
     static constexpr int _CommitSpacing         = 1;
+    static constexpr int _PanelHeightMin        = 3; // CommitPanel height with an empty message
     
     static const char* _ReadOnlyReason(Rev::Mutability mutability) {
         switch (mutability) {
-        case Rev::Mutability::Allowed:                      return nullptr;
-        case Rev::Mutability::DisallowedUncommittedChanges: return "(uncommitted changes)";
+        case Rev::Mutability::Allowed:                              return nullptr;
+        case Rev::Mutability::DisallowedUncommittedChanges:         return "(uncommitted changes)";
+        case Rev::Mutability::DisallowedUncommittedChangesCheck:    return "(checking for changes)";
         }
         // Invalid mutability
         abort();
     }
     
+    // _panelsUpdate(): creates panels for the loaded commits that fit in our height,
+    // followed by placeholders for the remaining space if we're still loading
+    void _panelsUpdate() {
+        // Keep showing our existing panels until the new load produces something, so
+        // that scrolling doesn't flash placeholders when loading is quick
+        if (loading() && _loadIds.empty() && !_panels.empty()) return;
+    
+        CommitPanelVec panels;
+        int offY = _CommitsInsetY;
+        for (const Git::Id& id : _loadIds) {
+            // Reuse the existing panel for `id`, if there is one
+            CommitPanelPtr panel;
+            for (CommitPanelPtr p : _panels) {
+                if (git_oid_equal(&p->commit().id(), &id)) {
+                    panel = p;
+                    break;
+                }
+            }
+            
+            if (!panel) {
+                panel = subviewCreate<CommitPanel>();
+                panel->commit(_repo.commitLookup(id));
+            }
+            
+            const Size panelSize = panel->sizeIntrinsic({_size.x, ConstraintNone});
+            const int rem = _size.y-offY;
+            if (panelSize.y > rem) break;
+            
+            panels.push_back(panel);
+            offY += panelSize.y + _CommitSpacing;
+        }
+        
+        // Panels that are no longer visible are released here
+        _panels = panels;
+        
+        size_t placeholderCount = 0;
+        if (loading()) {
+            const int rem = std::max(0, _size.y-offY+_CommitSpacing);
+            placeholderCount = rem/(CommitPlaceholderPanel::Height+_CommitSpacing);
+        }
+        
+        while (_placeholders.size() < placeholderCount) {
+            _placeholders.push_back(subviewCreate<CommitPlaceholderPanel>());
+        }
+        _placeholders.resize(placeholderCount);
+        
+        layoutNeeded(true);
+    }
+
 //    void _nameChanged(TextField& field) {
 //        throw std::runtime_error("_nameChanged");
 //    }
@@ -254,6 +366,14 @@ private:
     Rev _rev;
     bool _head = false;
     CommitPanelVec _panels;
+    size_t _scroll = 0; // Number of commits scrolled past the top of the column
+    
+    CommitLoaderPtr _loader;
+    Git::Commit _loadHead; // Commit that `_loadIds` descend from
+    std::vector<Git::Id> _loadIds; // Loaded commits, starting at our scroll position
+    bool _historyEnd = false; // Whether `_loadIds` ends with the root commit
+    Size _size;
+    std::vector<CommitPlaceholderPanelPtr> _placeholders;
     
     TextFieldPtr _nameField     = subviewCreate<TextField>();
     LabelPtr _statusLine1       = subviewCreate<Label>();
@@ -213,6 +213,10 @@ public:
                 // >= and not > so that deadline=now() can be given and we're
                 // guaranteed to perform a single iteration
                 if (steady_clock::now() >= deadline) return {};
+                // The timeout is truncated to milliseconds, so it can expire slightly
+                // before `deadline`; wait for the remainder rather than returning ERR
+                // as an event
+                continue;
             }
             
             Event ev = {
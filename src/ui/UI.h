@@ -96,6 +96,8 @@ struct Event {
         KeyRight        = KEY_RIGHT,
         KeyUp           = KEY_UP,
         KeyDown         = KEY_DOWN,
+        KeyPageUp       = KEY_PPAGE,
+        KeyPageDown     = KEY_NPAGE,
         KeyTab          = '\t',
         KeyBackTab      = KEY_BTAB,
         KeyEscape       = '\x1B',
@@ -137,6 +139,15 @@ struct Event {
         return mouse.bstate & _UpMaskForButtons(buttons);
     }
     
+    // mouseScroll(): returns the direction of a scroll-wheel event (-1: up, +1: down),
+    // or 0 if this isn't a scroll-wheel event
+    int mouseScroll() const {
+        if (type != Type::Mouse) return 0;
+        if (mouse.bstate & BUTTON4_PRESSED) return -1;
+        if (mouse.bstate & BUTTON5_PRESSED) return +1;
+        return 0;
+    }
+    
 private:
     static mmask_t _DownMaskForButtons(MouseButtons buttons) {
         mmask_t r = 0;